@@ -0,0 +1,16 @@
+#!/usr/bin/env sh
+
+# End-to-end benchmark of solaXd against simulated inverters on a pseudo-terminal,
+# options are passed to every scenario, e.g. "./benchmark.sh -T 30" (see "./solaxd_bench --help")
+
+gcc -Wall -O2 solaxd.c -o solaxd -pthread -lrt                || exit 1
+gcc -Wall -Wextra -O2 solaxd_bench.c -o solaxd_bench -pthread || exit 1
+
+# poll loop alone, no HTTP load
+./solaxd_bench -c 0 "$@"
+# front-end under load
+./solaxd_bench -c 8 "$@"
+# several inverters at a short query interval
+./solaxd_bench -n 4 -i 250 -l 20 "$@"
+# bus errors
+./solaxd_bench -e 10 -s 20 "$@"
@@ -19,11 +19,14 @@
 
 /*********************************************************************************************/
 
+#define _GNU_SOURCE
+
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
@@ -33,8 +36,20 @@
 #include <termios.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <pthread.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
 
 /*** Defines ********************************************************************************************/
 
@@ -47,22 +62,117 @@
 #define DEFAULT_INVERTER_ADDRESS   0x0A                   // must be unique in case of more inverters in the same RS485 bus
 #define DEFAULT_LOG_FILE           NULL                   // stderr is used if NULL
 #define DEFAULT_LOG_LEVEL          LOG_TRACE              // support for different log levels
+#define DEFAULT_TRACE_SAMPLE       1                      // frames of 1 in N exchanges logged at trace level, 0 = only faulty frames
 #define DEFAULT_TEST_MODE          0                      // enabled / disabled of test & debug code
+#define DEFAULT_MQTT_BROKER        NULL                   // MQTT publisher disabled if NULL
+#define DEFAULT_MQTT_PORT          1883
+#define DEFAULT_MQTT_TOPIC         "solaxd"               // topic prefix
+#define DEFAULT_MQTT_DEADBAND      0                      // minimum change of a value to be published (in percent)
+#define DEFAULT_HISTORY_FILE       NULL                   // sample history disabled if NULL
+#define DEFAULT_HISTORY_SYNC       60                     // write back interval of the history file (in seconds)
+#define DEFAULT_QUERY_INTERVAL     1000                   // query schedule of the inverters (in milliseconds)
+#define DEFAULT_ADAPTIVE           0                      // enabled / disabled adaptive query interval
+#define DEFAULT_CAPTURE_FILE       NULL                   // capture of the bus traffic disabled if NULL
+#define DEFAULT_REPLAY_FILE        NULL                   // serial interface used if NULL
+#define DEFAULT_REPLAY_FAST        0                      // replay in real time / as fast as possible
+#define DEFAULT_HTTP_THREADS       1                      // HTTP front-end threads
+#define DEFAULT_SHM_NAME           NULL                   // shared memory snapshot disabled if NULL
+#define DEFAULT_SHM_NOTIFY         NULL                   // notify socket of the shared memory disabled if NULL
+#define DEFAULT_STATE_FILE         NULL                   // warm start disabled if NULL
+#define DEFAULT_CONFIG_FILE        "/etc/default/solaxd"  // options read again on SIGHUP
+#define DEFAULT_INFLUX_SERVER      NULL                   // InfluxDB exporter disabled if NULL
+#define DEFAULT_INFLUX_PORT        8086
+#define DEFAULT_INFLUX_PATH        "/write?db=solaxd"     // write endpoint, precision of the timestamps is nanoseconds
+#define DEFAULT_INFLUX_SPILL       NULL                   // samples dropped while the queue is full if NULL
+
+#define QUALITY_OF_SERVICE_INTERVAL_MS  100000         // QoS interval (in milliseconds)
+#define TIMEOUT_INVERTER_ONLINE_MS      30000          // inverter offline without valid data (in milliseconds)
+#define MAX_AVERAGE_INTERVAL            (QUALITY_OF_SERVICE_INTERVAL_MS / 1000)  // upper bound of the average interval (in seconds)
+#define SAMPLE_BUFFER_COUNT        1024                   // samples kept per inverter, QoS interval at the shortest query interval
+#define SAMPLE_TIME_REBASE         (1LL << 31)            // sample times relative to their base before the base is moved (in milliseconds)
 
-#define QUALITY_OF_SERVICE_COUNT   100                    // QoS interval (in seconds)
-#define TIMEOUT_INVERTER_ONLINE    30                     // in seconds
-#define MAX_INDEX_OF_LIVE_DATA     (QUALITY_OF_SERVICE_COUNT - 1)
+#define MIN_QUERY_INTERVAL         100                    // in milliseconds
+#define ADAPTIVE_OFFLINE_INTERVAL  10000                  // query interval while all inverters are offline (in milliseconds)
+#define ADAPTIVE_TIMEOUT_FACTOR    3                      // response timeout as multiple of the average response time
+#define ADAPTIVE_TIMEOUT_MIN       50                     // in milliseconds
+#define ADAPTIVE_TIMEOUT_MAX       1000                   // in milliseconds
+#define RECONNECT_LIVE_ERRORS      2                      // failed live data queries until the inverter is registered again
+#define RECONNECT_QUERIES          4                      // queries of one inverter in one round while reconnecting
+#define RECONNECT_TIMEOUT          300                    // response timeout while reconnecting, until the response time is measured (in milliseconds)
+#define RECONNECT_BACKOFF_MAX      8000                   // maximum delay of the next attempt of a missing inverter (in milliseconds)
+#define FRAMER_BUFFER_SIZE         256                    // receive ring buffer (power of 2)
+#define MAX_INVERTERS              8                      // inverters on all buses together
+#define MAX_BUSES                  4                      // serial devices, each with its own RS485 bus
+#define RESPONSE_TIMEOUT_SHARE     90                     // part of the query interval shared by the responses of all inverters (in percent)
+#define HTTP_RESPONSE_SIZE         (1000 * MAX_INVERTERS)
+#define HTTP_HEADER_SIZE           512
+#define HTTP_REQUEST_SIZE          2048                   // maximum size of request line + header
+#define MAX_HTTP_CLIENTS           32                     // simultaneous HTTP connections
+#define HTTP_KEEPALIVE_TIMEOUT     30                     // idle connections are closed (in seconds)
+#define HTTP_EVENT_SIZE            1024                   // one server-sent event
+#define MAX_HTTP_THREADS           8                      // HTTP front-end threads, each with its own connections
+
+#define MQTT_BUFFER_SIZE           8192                   // pending publishes
+#define MQTT_KEEPALIVE             60                     // in seconds
+#define MQTT_BACKOFF_MAX           300                    // maximum reconnect delay (in seconds)
+#define INFLUX_MEASUREMENT         "solaxd"
+#define INFLUX_BUFFER_SIZE         65536                  // queued lines, about 140 samples
+#define INFLUX_BATCH_SIZE          16384                  // queued lines posted without waiting for the flush interval
+#define INFLUX_LINE_SIZE           1024                   // maximum length of the line of one sample
+#define INFLUX_FLUSH_INTERVAL      10                     // maximum delay of a queued line (in seconds)
+#define INFLUX_TIMEOUT             10                     // of a post, until the response is received (in seconds)
+#define INFLUX_BACKOFF_MAX         300                    // maximum delay of the next post after a failed one (in seconds)
+#define INFLUX_SPILL_MAX           (64 * 1024 * 1024)     // maximum size of the spill file (in bytes)
+#define BINARY_VERSION             2                      // layout of /live.bin
+#define BINARY_RECORD_SIZE         (8 + 2 * REGISTER16_COUNT + 4 * REGISTER32_COUNT)  // bytes per inverter in /live.bin
+#define HISTORY_RECORD_COUNT       (7 * 24 * 3600)        // records of a new history file, one week at 1 sample per second
+#define HISTORY_HEADER_SIZE        4096                   // records start at the second page
+#define HISTORY_VERSION            2
+#define HISTORY_JSON_SIZE          512                    // maximum length of one record in the /history response
+#define ROLLUP_MINUTE_COUNT        1440                   // buckets of one minute, one day
+#define ROLLUP_HOUR_COUNT          744                    // buckets of one hour, 31 days
+#define ROLLUP_DAY_COUNT           366                    // buckets of one day, one year
+#define ROLLUP_BUCKET_COUNT        (ROLLUP_MINUTE_COUNT + ROLLUP_HOUR_COUNT + ROLLUP_DAY_COUNT)
+#define ROLLUP_TIER_COUNT          3                      // see rollup_Tiers[]
+#define ROLLUP_JSON_SIZE           3072                   // maximum length of one bucket in the /rollup response
+#define CAPTURE_VERSION            1
+#define STATE_VERSION              2
+#define STATE_SYNC_INTERVAL        300                    // save interval of the state file (in seconds), saved at exit too
+#define SHM_VERSION                1                      // layout of the shared memory segment
+#define SHM_NAME_SIZE              32                     // field names in the shared memory segment
+#define SHM_MAX_SUBSCRIBERS        16                     // connections of the notify socket
+#define CAPTURE_DATA_SIZE          FRAMER_BUFFER_SIZE     // maximum data of one record, a frame or one read of the bus
+#define METRICS_BUCKET_COUNT       10                     // buckets of a histogram, excluding +Inf
+#define METRICS_FAMILY_COUNT       (7 + LIVE_FIELD_COUNT)  // see http_Metrics_Family()
+#define METRICS_PART_SIZE          2048                   // maximum length of the samples of one family and inverter
+#define TIMING_RECORD_COUNT        256                    // exchanges kept for /timing (power of 2)
+#define TIMING_JSON_SIZE           256                    // maximum length of one record in the /timing response
+#define REGISTER_COUNT             21                     // decoded fields of the live data response, see solax_Registers[]
+#define REGISTER16_COUNT           18                     // registers of 2 bytes, a uint16_t column each in Solax_Samples_t
+#define REGISTER32_COUNT           3                      // registers of 4 bytes, a uint32_t column each in Solax_Samples_t
+#define LIVE_FIELD_COUNT           (2 + REGISTER_COUNT)   // see solax_FieldName()
+#define MAX_EPOLL_EVENTS           16                     // events handled per epoll_wait() call
+#define AVERAGE_FIELD_COUNT        9                      // live data with mean value, see solax_AverageFields[]
+#define MAXIMUM_FIELD_COUNT        11                     // live data with maximum value, see solax_MaximumFields[]
 
 /*** Macros ********************************************************************************************/
 
 #define lowByte(i)    ( (uint8_t) i )
 #define highByte(i)   ( (uint8_t) ( ((int) i) >> 8) )
 
+#define LIVE_DATA_FLOAT(data, offset)    (*(float*)((uint8_t*)(data) + (offset)))
+#define LIVE_DATA_BITS(data, offset)     (*(uint32_t*)((uint8_t*)(data) + (offset)))
+#define CONTAINER_OF(ptr, type, member) ((type*)((uint8_t*)(ptr) - offsetof(type, member)))
+
 #define ERROR_MESSAGE(...)   if (arg_LogLevel >= LOG_ERROR ) { log_Message(LOG_ERROR,  fp_log_file, __VA_ARGS__); }
 #define NOTICE_MESSAGE(...)  if (arg_LogLevel >= LOG_NOTICE) { log_Message(LOG_NOTICE, fp_log_file, __VA_ARGS__); }
 #define INFO_MESSAGE(...)    if (arg_LogLevel >= LOG_INFO  ) { log_Message(LOG_INFO,   fp_log_file, __VA_ARGS__); }
 #define DEBUG_MESSAGE(...)   if (arg_LogLevel >= LOG_DEBUG ) { log_Message(LOG_DEBUG,  fp_log_file, __VA_ARGS__); }
 #define TRACE_MESSAGE(...)   if (arg_LogLevel >= LOG_TRACE ) { log_Message(LOG_TRACE,  fp_log_file, __VA_ARGS__); }
+#define LOG_RING_SIZE        512  // queued log lines (power of 2)
+#define LOG_LINE_SIZE        1024 // maximum length of a log line, longer lines are truncated
+#define LOG_BATCH_SIZE       64   // log lines written by one writev()
+#define LOG_FLUSH_MS         100  // poll interval of the background writer (in milliseconds)
 #define LOG_USE_COLOR        // If the library is compiled with `-DLOG_USE_COLOR` ANSI color escape codes will be used when printing.
 
 /*** Typedefs ******************************************************************************************/
@@ -76,6 +186,25 @@ typedef enum
     LOG_TRACE
 } logLevel_t;
 
+typedef struct
+{
+    uint32_t sequence;          // position of the slot in the ring, + 1 when the line is complete
+    uint16_t length;
+    char     text[LOG_LINE_SIZE];
+} Log_Slot_t;
+
+typedef struct
+{
+    Log_Slot_t slots[LOG_RING_SIZE];
+    uint32_t   head;            // next position claimed by log_Message()
+    uint32_t   tail;            // next position written by the background writer
+    uint32_t   dropped;         // messages lost because the ring was full
+    uint32_t   droppedReported; // dropped messages already reported in the log
+    bool       running;
+    pthread_t  thread;
+    int        fd;
+} Log_Ring_t;
+
 typedef enum
 {
     STATE_BROARDCAST,
@@ -88,7 +217,8 @@ typedef enum
     ERR_NONE = 0,
     ERR_NO_DATA,
     ERR_INVALID_MSG,
-    ERR_CRC_ERROR
+    ERR_CRC_ERROR,
+    ERR_INCOMPLETE            // response not (yet) completely received
 } Solax_ErrorQuery_t;
 
 typedef struct
@@ -117,52 +247,619 @@ typedef struct
     float Power;
     float Energy_Total;
     float Runtime_Total;
-    uint8_t Status;
+    float Status;
     uint32_t ErrorBits;
+    float Grid_Voltage_Fault;
+    float Grid_Frequency_Fault;
+    float DCI_Fault;
+    float Temperature_Fault;
+    float PV1_Voltage_Fault;
+    float PV2_Voltage_Fault;
+    float GFC_Fault;
 } Solax_LiveData_t;
 
+typedef struct
+{
+    bool     valid;
+    uint32_t raw[REGISTER_COUNT];  // register values of the response frame, in the order of solax_Registers[], 0 if not valid
+} Solax_RawData_t;
+
+typedef struct
+{
+    const char* name;             // JSON key, MQTT topic and metric name
+    const char* unit;
+    uint8_t     precision;        // decimals of the output
+    uint8_t     offset;           // first byte in the response data
+    uint8_t     width;            // bytes, 2 or 4
+    bool        littleEndian;
+    bool        bits;             // uint32_t bit field instead of float
+    float       scale;
+    size_t      field;            // offset in Solax_LiveData_t
+    uint8_t     column;           // of the width in Solax_Samples_t
+} Solax_Register_t;
+
+typedef struct
+{
+    uint16_t raw16[REGISTER16_COUNT][SAMPLE_BUFFER_COUNT];  // raw register values, one column per register, 0 if not valid
+    uint32_t raw32[REGISTER32_COUNT][SAMPLE_BUFFER_COUNT];
+    uint8_t  valid[SAMPLE_BUFFER_COUNT];
+    uint32_t time[SAMPLE_BUFFER_COUNT];                     // monotonic time after timeBase (in milliseconds)
+    int64_t  timeBase;
+} Solax_Samples_t;
+
+typedef struct
+{
+    uint16_t sample[SAMPLE_BUFFER_COUNT];         // ring indices of the samples, values in decreasing order
+    uint16_t head;
+    uint16_t count;
+} Solax_MaxDeque_t;
+
+typedef struct
+{
+    int64_t          length;                          // time used for average calculation (in milliseconds)
+    uint32_t         oldest;                          // number of the oldest sample in window
+    uint32_t         oldestQoS;                       // number of the oldest sample in QoS interval
+    int64_t          sum[AVERAGE_FIELD_COUNT];        // running sums of the raw values of valid samples in window
+    uint16_t         countValid;                      // valid samples in window
+    uint16_t         countQoS;                        // valid samples in QoS interval
+    uint16_t         countErrorBit[32];               // samples in window with error bit set
+    Solax_MaxDeque_t max[MAXIMUM_FIELD_COUNT];
+} Solax_Window_t;
+
+typedef struct
+{
+    uint64_t queries[3];                                // per Solax_StateQuery_t
+    uint64_t responses[ERR_INCOMPLETE];                 // per Solax_ErrorQuery_t
+    uint64_t stateChanges[3][3];                        // [from][to]
+} Solax_Counters_t;
+
+typedef struct
+{
+    uint8_t            Address;
+    uint8_t            SerialNumber[15];
+    bool               Online;
+    float              QualityOfService;
+    Solax_StateQuery_t StateQuery;
+    int64_t            TimeValid;                               // monotonic time of the last live data (in milliseconds)
+    int                CountError;
+    bool               QueryAgain;                              // next step of the reconnection follows in the same round
+    int                RoundQueries;                            // queries in the current round
+    int                Backoff;                                 // delay of the next attempt while missing (in milliseconds)
+    int64_t            TimeRetry;                               // monotonic time of the next attempt (in milliseconds)
+    Solax_LiveData_t   LiveData;                                // average of the samples
+    Solax_Samples_t    Samples;                                 // ring of the last samples, number % SAMPLE_BUFFER_COUNT
+    uint32_t           SampleCount;                             // number of the next sample
+    Solax_Window_t     Window;
+    Solax_Counters_t   Counters;
+    struct Solax_Bus_s* Bus;                                    // bus the inverter is connected to
+} Solax_Inverter_t;
+
+typedef struct
+{
+    uint8_t  buffer[FRAMER_BUFFER_SIZE];
+    uint16_t head;          // index of oldest byte
+    uint16_t count;         // bytes in ring buffer
+    uint16_t frameLength;   // length of frame starting at head, 0 = not yet synchronized
+    uint16_t scanned;       // bytes of frame added to checksum
+    uint16_t checksum;      // running checksum, same sum as solax_CalculateCRC()
+    uint16_t discarded;     // bytes skipped while searching a header
+} Solax_Framer_t;
+
+typedef struct
+{
+    uint32_t sequence;              // number of the exchange
+    uint8_t  bus;                   // index of the bus
+    uint8_t  address;
+    uint8_t  state;                 // Solax_StateQuery_t of the query
+    uint8_t  result;                // Solax_ErrorQuery_t of the response
+    uint8_t  txBytes;
+    uint16_t rxBytes;
+    int64_t  txTime;                // write() of the query returned (monotonic, in nanoseconds)
+    int64_t  rxFirstTime;           // first byte of the response received, 0 = none
+    int64_t  rxFrameTime;           // response frame completed, 0 = none
+    int64_t  endTime;               // exchange finished by frame or timeout
+} Timing_Record_t;
+
+typedef struct
+{
+    Timing_Record_t records[TIMING_RECORD_COUNT];
+    uint32_t        written;        // completed records, the next record is written to written % count
+} Timing_Ring_t;
+
+typedef struct
+{
+    char     data[HTTP_RESPONSE_SIZE];    // response body
+    int      length;
+    uint32_t generation;                  // sample generation the response is rendered from
+    uint32_t etag;                        // sample generation the body has changed last
+    uint64_t hash;                        // of the body, tells an unchanged body
+} Http_Response_t;
+
+typedef enum
+{
+    STREAM_NONE = 0,
+    STREAM_SAMPLE,            // averaged live data of each new sample
+    STREAM_RAW                // live data of each received frame
+} Http_Stream_t;
+
+typedef struct
+{
+    const double* bounds;                               // upper bounds of the buckets (in seconds)
+    uint64_t      count[METRICS_BUCKET_COUNT + 1];      // per bucket, not cumulative, last = +Inf
+    uint64_t      total;
+    double        sum;
+} Metrics_Histogram_t;
+
+typedef struct
+{
+    uint64_t            rxBytes;
+    uint64_t            rxFrames;
+    uint64_t            rxDiscarded;                    // bytes skipped while searching a header
+    uint64_t            txFrames;
+    Metrics_Histogram_t queryLatency;                   // query sent until response frame completed
+} Metrics_t;
+
+typedef struct
+{
+    uint8_t            Address;
+    bool               Online;
+    bool               Valid;                                   // valid samples in the average window
+    float              QualityOfService;
+    Solax_StateQuery_t StateQuery;
+    uint32_t           SampleCount;                             // number of the next sample
+    Solax_LiveData_t   LiveData;                                // average of the samples
+    Solax_LiveData_t   Sample;                                  // last sample
+    Solax_Counters_t   Counters;
+} Solax_Snapshot_Inverter_t;
+
+typedef struct
+{
+    uint32_t                  sequence;                         // seqlock, odd while the serial thread writes
+    uint32_t                  generation;                       // solax_SampleGeneration
+    int                       inverterCount;
+    Metrics_t                 metrics;                          // counters of the serial interface
+    Solax_Snapshot_Inverter_t inverters[MAX_INVERTERS];
+} Solax_Snapshot_t;
+
+typedef struct Event_Handler_s
+{
+    int fd;
+    int (*callback)(struct Event_Handler_s* handler, uint32_t events);
+} Event_Handler_t;
+
+typedef struct
+{
+    const char* prefix;                                 // of the device name, "" for the serial interface
+    int (*open)(struct Solax_Bus_s* bus);               // at startup, before the event loop
+    int (*query)(struct Solax_Bus_s* bus);              // before each query: discard late responses, reconnect
+    int (*write)(struct Solax_Bus_s* bus, const void* data, int length);
+    int (*error)(struct Solax_Bus_s* bus, const char message[]);   // read or write failed, NULL = fatal
+} Solax_Transport_t;
+
+typedef struct Solax_Bus_s
+{
+    Event_Handler_t   handler;                          // serial interface, first member, passed back by the event loop
+    Event_Handler_t   timerQuery;                       // query schedule
+    Event_Handler_t   timerResponse;                    // response timeout
+    int               index;
+    const char*       device;
+    const Solax_Transport_t* transport;
+    struct sockaddr_storage addr;                       // network transport: resolved once at startup
+    socklen_t         addrLen;
+    bool              connected;
+    int               backoff;                          // delay of the next connection attempt (in milliseconds)
+    int64_t           reconnectTime;                    // monotonic time of the next connection attempt (in milliseconds)
+    Solax_Framer_t    framer;
+    Solax_Message_t   rxMessage;
+    Timing_Record_t   timing;                           // exchange in progress, copied to the timing ring when finished
+    Solax_Inverter_t* inverters[MAX_INVERTERS];
+    int               inverterCount;
+    bool              queryPending;                     // query sent, response outstanding
+    bool              queryTrace;                       // frames of the pending query are logged at trace level
+    int               queryNext;                        // index of the next inverter queried in this round
+    Solax_Inverter_t* queryInverter;                    // inverter of the pending query
+    double            queryTime;                        // monotonic time the pending query was sent
+    int64_t           timeStart;                        // monotonic time of the first query round (in milliseconds)
+    int64_t           roundStart;                       // monotonic time the current query round was started (in milliseconds)
+    int64_t           roundPeriod;                      // time between the last two rounds (in milliseconds)
+    double            latencyAverage;                   // average response time (in milliseconds), 0 = not yet measured
+} Solax_Bus_t;
+
+typedef struct
+{
+    int64_t          Time;          // realtime of the sample (in milliseconds)
+    uint8_t          Address;
+    uint8_t          reserved[3];
+    uint32_t         sequence;      // seqlock, odd while the serial thread overwrites the record
+    Solax_LiveData_t LiveData;
+} History_Record_t;
+
+typedef struct
+{
+    char     magic[8];              // "SOLAXHIS"
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t capacity;              // records in ring
+    uint64_t written;               // records written since creation, next record at written % capacity
+} History_Header_t;
+
+typedef struct
+{
+    int               fd;
+    History_Header_t* header;       // mapping of the whole file
+    History_Record_t* records;
+    size_t            mapLength;
+    uint64_t          synced;       // records written back to the file
+    time_t            lastSync;
+    bool              clockBack;    // realtime behind the last record, the times are clamped
+} History_t;
+
+typedef struct
+{
+    const char* name;               // path of the endpoint, /rollup/<name>
+    int         duration;           // of a bucket (in seconds)
+    int         count;              // buckets in the ring of the tier
+    int         first;              // index of the first bucket of the tier in Rollup_t
+} Rollup_Tier_t;
+
+typedef struct
+{
+    uint32_t         sequence;      // seqlock, odd while the serial thread writes
+    uint32_t         count;         // valid samples in the bucket
+    int64_t          number;        // local time / duration, tells the bucket from the one of the last pass of the ring
+    int64_t          start;         // realtime of the begin (unix time in seconds)
+    double           energy;        // increase of energy_total (in kWh)
+    double           sum[REGISTER_COUNT];
+    Solax_LiveData_t min;           // error_bits: set in all samples
+    Solax_LiveData_t max;           // error_bits: set in any sample
+    Solax_LiveData_t last;
+} Rollup_Bucket_t;
+
+typedef struct
+{
+    Rollup_Bucket_t buckets[ROLLUP_BUCKET_COUNT];   // the rings of all tiers, see rollup_Tiers[]
+    float           energyTotal;    // energy_total of the previous valid sample
+    bool            energyValid;
+} Rollup_t;
+
+typedef struct
+{
+    char     magic[8];              // "SOLAXSTA"
+    uint32_t version;
+    uint32_t registerCount;         // REGISTER_COUNT, registers of a sample
+    uint32_t count;                 // inverter records, each followed by its samples
+    uint32_t reserved;
+    int64_t  realTime;              // realtime of the save (in nanoseconds)
+    int64_t  monotonicTime;         // monotonic time of the save (in nanoseconds)
+} State_Header_t;
+
+typedef struct
+{
+    uint8_t  address;
+    uint8_t  serialNumber[15];
+    uint8_t  stateQuery;
+    uint8_t  online;
+    uint16_t sampleCount;           // samples of the QoS interval following the record, the oldest first
+    float    qualityOfService;
+    int64_t  timeValid;             // monotonic time of the last live data (in milliseconds)
+} State_Inverter_t;
+
+typedef struct
+{
+    int32_t  age;                   // time before the save (in milliseconds)
+    uint8_t  valid;
+    uint8_t  reserved[3];
+    uint32_t raw[REGISTER_COUNT];   // register values in the order of solax_Registers[]
+} State_Sample_t;
+
+typedef enum
+{
+    CAPTURE_TX = 0,
+    CAPTURE_RX
+} Capture_Direction_t;
+
+typedef struct
+{
+    char     magic[8];              // "SOLAXCAP"
+    uint32_t version;
+    uint32_t reserved;
+    int64_t  realTime;              // realtime at the start of the capture (in nanoseconds)
+    int64_t  monotonicTime;         // monotonic time at the start of the capture (in nanoseconds)
+} Capture_Header_t;
+
+typedef struct
+{
+    int64_t  time;                  // monotonic time (in nanoseconds)
+    uint16_t length;                // bytes of data following the record
+    uint8_t  direction;             // see Capture_Direction_t
+    uint8_t  bus;                   // index of the bus
+    uint8_t  reserved[4];
+} Capture_Record_t;
+
+typedef struct
+{
+    Event_Handler_t  handler;       // timer of the real time replay, must be the first member
+    FILE*            fp;
+    int              peer;          // bus side of the socket pair, the serial interface of bus 0 is the other side
+    bool             fast;          // as fast as possible, the capture time replaces the monotonic clock
+    bool             done;          // end of capture
+    int64_t          clock;         // capture time (in nanoseconds)
+    int64_t          txTime;        // capture time of the replayed query
+    int64_t          queryTime;     // monotonic time the replayed query was sent
+    uint64_t         exchanges;
+    Capture_Record_t next;          // next record of the capture
+    uint8_t          data[CAPTURE_DATA_SIZE];
+} Replay_t;
+
+typedef struct
+{
+    bool     first;                 // no record sent yet
+    uint64_t next;                  // number of the next record
+    int64_t  from, to, step;        // requested range (in milliseconds), step 0 = all records
+    int64_t  bucket;                // step interval of the last sent record
+    uint8_t  sent[MAX_INVERTERS];   // addresses sent in this step interval
+    int      sentCount;
+} Http_History_t;
+
+typedef enum
+{
+    MQTT_DISCONNECTED = 0,
+    MQTT_CONNECTING,          // TCP connection in progress
+    MQTT_WAIT_CONNACK,
+    MQTT_CONNECTED
+} Mqtt_State_t;
+
+typedef struct
+{
+    Event_Handler_t handler;                            // first member, passed back by the event loop
+    Mqtt_State_t state;
+    struct sockaddr_storage addr;                       // resolved once at startup, no DNS lookup in the event loop
+    socklen_t addrLen;
+    uint8_t  txBuffer[MQTT_BUFFER_SIZE];
+    int      txLength;
+    uint8_t  rxBuffer[64];
+    int      rxLength;
+    int      backoff;                                   // reconnect delay (in seconds)
+    time_t   reconnectTime;
+    time_t   lastTx;
+    char     published[MAX_INVERTERS][LIVE_FIELD_COUNT][16];   // retained payloads, "" = not published
+} Mqtt_Client_t;
+
+typedef struct
+{
+    bool     first;                 // no bucket sent yet
+    const Rollup_Tier_t* tier;
+    int64_t  next;                  // number of the next bucket of the /rollup response
+    int64_t  end;                   // number of the bucket following the current one when the request was received
+    int      index;                 // next inverter of the bucket
+    int      address;               // -1 = all inverters
+} Http_Rollup_t;
+
+typedef enum
+{
+    INFLUX_IDLE = 0,
+    INFLUX_CONNECTING,        // TCP connection in progress
+    INFLUX_SENDING,
+    INFLUX_WAIT_RESPONSE
+} Influx_State_t;
+
+typedef struct
+{
+    Event_Handler_t handler;                            // first member, passed back by the event loop
+    Influx_State_t state;
+    struct sockaddr_storage addr;                       // resolved once at startup, no DNS lookup in the event loop
+    socklen_t addrLen;
+    char     host[256];                                 // "host[:port]", Host header of the request
+    char     path[256];
+    char     queue[INFLUX_BUFFER_SIZE];                 // lines of the samples not yet posted
+    int      length;
+    int      batchLength;                               // lines of the post in progress, at the start of the queue
+    char     header[HTTP_HEADER_SIZE];                  // of the post in progress
+    int      headerLength;
+    int      txOffset;                                  // counts over the header and the batch
+    char     rxBuffer[64];                              // status line of the response
+    int      rxLength;
+    int      backoff;                                   // post delay after a failure (in seconds)
+    time_t   retryTime;
+    time_t   queueTime;                                 // oldest line in the queue
+    time_t   requestTime;                               // post in progress started
+    int      fd_spill;                                  // -1 = no spill file
+    off_t    spillOffset;                               // lines of the spill file queued again
+    off_t    spillSize;
+    uint64_t dropped;                                   // bytes of lines lost since the last successful post
+} Influx_Client_t;
+
+typedef struct
+{
+    int      family;                // next metric family of the /metrics response
+    int      index;                 // next inverter of the family, -1 = header
+} Http_Metrics_t;
+
+typedef struct
+{
+    bool     first;                 // no record sent yet
+    uint32_t next;                  // number of the next record of the /timing response
+    uint32_t end;                   // records completed when the request was received
+} Http_Timing_t;
+
+typedef struct Http_Connection_s
+{
+    Event_Handler_t handler;                            // first member, passed back by the event loop
+    char     rxBuffer[HTTP_REQUEST_SIZE];
+    int      rxLength;
+    char     txBuffer[HTTP_HEADER_SIZE + HTTP_RESPONSE_SIZE];
+    int      txLength;
+    int      txOffset;                                  // counts over the transmit buffer and the body
+    const char* body;                                   // pre-rendered body sent behind txBuffer, NULL = none
+    int      bodyLength;
+    bool     corked;                                    // TCP_CORK set while a chunked body is produced
+    bool     keepAlive;
+    char     ifNoneMatch[64];                           // If-None-Match of the request, "" = none
+    char     etag[32];                                  // ETag of the response, "" = none
+    Http_Stream_t stream;                               // subscribed server-sent events
+    int    (*producer)(struct Http_Connection_s* conn, char buffer[], int size);   // renders the next part of a chunked body, NULL = none
+    union
+    {
+        Http_History_t history;                         // state of the /history producer
+        Http_Metrics_t metrics;                         // state of the /metrics producer
+        Http_Timing_t  timing;                          // state of the /timing producer
+        Http_Rollup_t  rollup;                          // state of the /rollup producer
+    };
+    time_t   lastActivity;                              // monotonic time in seconds
+    double   requestTime;                               // monotonic time of the request in progress
+} Http_Connection_t;
+
+typedef struct
+{
+    char     magic[8];              // "SOLAXSHM"
+    uint32_t version;
+    uint32_t sequence;              // seqlock, odd while written
+    uint32_t generation;            // incremented with each new sample
+    uint32_t inverterCount;
+    uint32_t fieldCount;            // values of each live data
+    uint32_t recordSize;            // bytes per inverter record
+    uint32_t fieldsOffset;          // names of the fields, SHM_NAME_SIZE bytes each
+    uint32_t recordsOffset;         // first inverter record
+    int64_t  time;                  // realtime of the last update (in milliseconds)
+} Shm_Header_t;
+
+typedef struct
+{
+    uint8_t  address;
+    uint8_t  online;
+    uint8_t  valid;                         // valid samples in the average window
+    uint8_t  sampleValid;                   // last sample is valid
+    float    qualityOfService;
+    uint32_t sampleCount;                   // number of the next sample, changes with each response
+    uint32_t reserved;
+    double   liveData[REGISTER_COUNT];      // average, in the order of the field names
+    double   sample[REGISTER_COUNT];        // last sample
+} Shm_Inverter_t;
+
+typedef struct
+{
+    Shm_Header_t   header;
+    char           fields[REGISTER_COUNT][SHM_NAME_SIZE];
+    Shm_Inverter_t inverters[MAX_INVERTERS];
+} Shm_Segment_t;
+
+typedef struct
+{
+    Event_Handler_t handler;                            // listening notify socket, must be the first member
+    Shm_Segment_t*  segment;                            // mapping of the shared memory
+    int             subscribers[SHM_MAX_SUBSCRIBERS];   // connections of the notify socket, -1 = free
+} Shm_t;
+
+typedef struct
+{
+    pthread_t         thread;
+    int               fd_epoll;                         // event loop of the thread
+    Event_Handler_t   server;                           // listening socket shared by all threads
+    Event_Handler_t   notify;                           // eventfd, signalled for each new snapshot
+    Solax_Snapshot_t  snapshot;                         // copy the responses are rendered from
+    Http_Response_t   response;                         // pre-rendered response, served as-is to every client
+    Http_Response_t   responseBinary;                   // pre-rendered /live.bin
+    Http_Connection_t connections[MAX_HTTP_CLIENTS];
+    time_t            lastTimeout;
+} Http_Worker_t;
+
 /*** Static Data ******************************************************************************************/
 
-static char*      arg_TTY_Device   = DEFAULT_TTY_DEVICE_NAME;
 static int        arg_TCP_Port     = DEFAULT_TCP_PORT;
 static int        arg_AV_Samples   = DEFAULT_AVERAGE_SAMPLES;
-static int        arg_InverterAddr = DEFAULT_INVERTER_ADDRESS;
 static char*      arg_LogFile      = DEFAULT_LOG_FILE;
 static logLevel_t arg_LogLevel     = DEFAULT_LOG_LEVEL;
+static int        arg_TraceSample  = DEFAULT_TRACE_SAMPLE;
 static int        arg_TestMode     = DEFAULT_TEST_MODE;
+static char*      arg_MqttBroker   = DEFAULT_MQTT_BROKER;
+static char*      arg_MqttTopic    = DEFAULT_MQTT_TOPIC;
+static float      arg_MqttDeadband = DEFAULT_MQTT_DEADBAND;
+static char*      arg_HistoryFile  = DEFAULT_HISTORY_FILE;
+static int        arg_HistorySync  = DEFAULT_HISTORY_SYNC;
+static int        arg_QueryInterval = DEFAULT_QUERY_INTERVAL;
+static int        arg_Adaptive     = DEFAULT_ADAPTIVE;
+static char*      arg_CaptureFile  = DEFAULT_CAPTURE_FILE;
+static char*      arg_ReplayFile   = DEFAULT_REPLAY_FILE;
+static int        arg_ReplayFast   = DEFAULT_REPLAY_FAST;
+static int        arg_HttpThreads  = DEFAULT_HTTP_THREADS;
+static char*      arg_ShmName      = DEFAULT_SHM_NAME;
+static char*      arg_ShmNotify    = DEFAULT_SHM_NOTIFY;
+static char*      arg_StateFile    = DEFAULT_STATE_FILE;
+static char*      arg_ConfigFile   = DEFAULT_CONFIG_FILE;
+static char*      arg_InfluxServer = DEFAULT_INFLUX_SERVER;
+static char*      arg_InfluxSpill  = DEFAULT_INFLUX_SPILL;
+static const char arg_Options[]    = ":d:p:w:s:i:Aa:l:L:T:m:t:D:I:F:H:S:M:N:P:C:c:r:fx";
+static int        arg_StartAV_Samples;      // values of the command line, kept for options missing in the config file
+static char*      arg_StartLogFile;
+static logLevel_t arg_StartLogLevel;
 
-static int        fd_tty           = -1;    /* File descriptor for serial interface */
 static int        fd_sock_server   = -1;    /* File descriptor for network socket */
+static __thread int fd_epoll       = -1;    /* File descriptor for event loop of the calling thread */
+static int        fd_signal        = -1;    /* File descriptor for signals */
 static FILE*      fp_log_file      = NULL;  /* File pointer for Log-File */
+static FILE*      fp_capture_file  = NULL;  /* File pointer for capture of the bus traffic */
+static Log_Ring_t log_Ring;                 /* Lines to be written by the background writer */
+
+static Solax_Inverter_t  solax_Inverters[MAX_INVERTERS];
+static int               solax_InverterCount = 0;
 
-static uint8_t           solax_InverterSerialNumber[15] = "";
-static bool              solax_InverterOnline = false;
-static float             solax_QualityOfService = 0;
-static Solax_LiveData_t  solax_LiveData = {0};
+static Solax_Bus_t       solax_Buses[MAX_BUSES];
+static int               solax_BusCount = 0;
+static uint32_t          solax_SampleGeneration = 0; // incremented with each new sample
+static uint32_t          solax_TraceCount = 0;       // exchanges since the last traced one
+static Solax_Snapshot_t  solax_Snapshot = {0};       // published by the serial thread, read by the HTTP threads
+
+static Http_Worker_t     http_Workers[MAX_HTTP_THREADS];
+static int               http_WorkerCount = 0;
+static __thread Http_Worker_t* http_Worker = NULL;   // HTTP thread of the caller
+static time_t            http_StartTime = 0;         // part of the ETags, the generation starts at 0 again after a restart
+static Mqtt_Client_t     mqtt_Client = {0};
+static Influx_Client_t   influx_Client = { .handler.fd = -1 };
+static History_t         history_File = { .fd = -1 };
+static Rollup_t          solax_Rollups[MAX_INVERTERS];  // in the order of solax_Inverters[], written by the serial thread
+static Replay_t          replay_File = { .handler.fd = -1, .peer = -1 };
+static Shm_t             shm_Data = { .handler.fd = -1 };
+static time_t            state_LastSave = 0;
+
+static const double      metrics_LatencyBounds[METRICS_BUCKET_COUNT] = { 0.01, 0.02, 0.05, 0.1, 0.2, 0.3, 0.5, 0.7, 1.0, 2.0 };
+static const double      metrics_ServeBounds[METRICS_BUCKET_COUNT]   = { 0.0001, 0.0002, 0.0005, 0.001, 0.002, 0.005, 0.01, 0.1, 1.0, 10.0 };
+static Timing_Ring_t     timing_Ring = {0};          // single writer, readers check the sequence number of a record
+static Metrics_t         metrics_Data = { .queryLatency.bounds = metrics_LatencyBounds };
+static Metrics_Histogram_t metrics_Serve = { .bounds = metrics_ServeBounds };    // shared by the HTTP threads
 
 /*** Functions ******************************************************************************************/
 
 void getDateTime(char dateTimeStr[])
 {
+    static __thread time_t cacheSec = -1;    // localtime() and strftime() only once per second
+    static __thread char   cacheStr[20];
     struct timespec timeNow;
-    struct tm* infoTimeNow;
+    struct tm infoTimeNow;
     int miliSec;
 
     clock_gettime(CLOCK_REALTIME, &timeNow);
-    infoTimeNow = localtime(&timeNow.tv_sec);
+    if (timeNow.tv_sec != cacheSec)
+    {
+        localtime_r(&timeNow.tv_sec, &infoTimeNow);
+        strftime(cacheStr, sizeof(cacheStr), "%Y-%m-%d %H:%M:%S", &infoTimeNow);
+        cacheSec = timeNow.tv_sec;
+    }
     miliSec = timeNow.tv_nsec / 1e6;
 
     // build time string: "yyyy-MM-DD hh:mm:ss.sss\0"   (len = 24)
-    strftime(dateTimeStr, 20, "%Y-%m-%d %H:%M:%S", infoTimeNow);
+    memcpy(dateTimeStr, cacheStr, 19);
     sprintf(&dateTimeStr[19], ".%03d", miliSec);
 }
 
 
-
+/* --- Format the message into a free slot of the log ring, the message is dropped if the ring is full --- */
 void log_Message(int level, FILE* fp, const char fmt[], ...)
 {
     va_list args;
     char dateTime[24];
+    Log_Slot_t* slot;
+    uint32_t pos, sequence;
+    int len;
     
     static const char *level_names[] = {"ERROR", "NOTE ", "INFO ", "DEBUG", "TRACE"};
     #ifdef LOG_USE_COLOR
@@ -179,698 +876,4383 @@ void log_Message(int level, FILE* fp, const char fmt[], ...)
         fprintf(stderr, "\n");
     }
     
+    // claim the slot at head, it is free if its sequence equals the position
+    pos = __atomic_load_n(&log_Ring.head, __ATOMIC_RELAXED);
+    while (1)
+    {
+        slot = &log_Ring.slots[pos & (LOG_RING_SIZE - 1)];
+        sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        if ((int32_t)(sequence - pos) < 0)
+        {
+            __atomic_fetch_add(&log_Ring.dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        if ((sequence == pos) && __atomic_compare_exchange_n(&log_Ring.head, &pos, pos + 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+        if (sequence != pos) pos = __atomic_load_n(&log_Ring.head, __ATOMIC_RELAXED);
+    }
+    
     getDateTime(dateTime);
     #ifdef LOG_USE_COLOR
-    fprintf(fp, "%s %s[%s]\x1b[0m ", dateTime, level_colors[level], level_names[level]);
+    len = snprintf(slot->text, sizeof(slot->text), "%s %s[%s]\x1b[0m ", dateTime, level_colors[level], level_names[level]);
     #else
-    fprintf(fp, "%s [%s] ", dateTime, level_names[level]);
+    len = snprintf(slot->text, sizeof(slot->text), "%s [%s] ", dateTime, level_names[level]);
     #endif
     va_start(args, fmt);
-    vfprintf(fp, fmt, args);
+    len += vsnprintf(&slot->text[len], sizeof(slot->text) - len, fmt, args);
     va_end(args);
-    fprintf(fp, "\n");
+    if (len > (int)sizeof(slot->text) - 1) len = sizeof(slot->text) - 1;    // truncated
+    slot->text[len++] = '\n';
+    slot->length = len;
     
-    fflush(fp);
+    // hand the slot over to the background writer
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
 }
 
 
-
-int log_Bin2Hex(char buff[], const uint8_t data[], const uint8_t dataLen)
+/* --- Write all completed slots with one writev() per batch, returns the number of written lines --- */
+int log_Drain(void)
 {
-    int x, i;
-    int len = 0;
+    struct iovec iov[LOG_BATCH_SIZE + 1];
+    char dropped[64];
+    Log_Slot_t* slot;
+    uint32_t count, lost;
+    int i, n = 0;
     
-    if (dataLen)
+    lost = __atomic_load_n(&log_Ring.dropped, __ATOMIC_RELAXED) - log_Ring.droppedReported;
+    if (lost)
     {
-        for (i=0; i < dataLen; i++)
-        {
-            if ((i % 8) == 0)
-            {
-                len += sprintf(&buff[len], " ");
-            }
-            x = data[i];
-            len += sprintf(&buff[len], "%02X ", x);
-        }
+        log_Ring.droppedReported += lost;
+        iov[n].iov_base = dropped;
+        iov[n].iov_len = sprintf(dropped, "Log: %u messages dropped\n", lost);
+        n++;
     }
-    else
+    
+    for (count = 0; count < LOG_BATCH_SIZE; count++)
     {
-        len = sprintf(buff, " No Data");
+        slot = &log_Ring.slots[(log_Ring.tail + count) & (LOG_RING_SIZE - 1)];
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != log_Ring.tail + count + 1) break;
+        iov[n].iov_base = slot->text;
+        iov[n].iov_len = slot->length;
+        n++;
     }
-    return len;
+    if (n == 0) return 0;
+    
+    if (writev(__atomic_load_n(&log_Ring.fd, __ATOMIC_ACQUIRE), iov, n) < 0) {}    // nowhere to report it
+    
+    // release the slots for the next round of the ring
+    for (i = 0; i < (int)count; i++)
+    {
+        slot = &log_Ring.slots[log_Ring.tail & (LOG_RING_SIZE - 1)];
+        __atomic_store_n(&slot->sequence, log_Ring.tail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+        log_Ring.tail++;
+    }
+    return n;
 }
 
 
-uint16_t solax_CalculateCRC(const uint8_t data[], const uint8_t dataLen)
+void* log_Writer(void* arg)
 {
-    uint8_t i;
-    uint16_t chkSum = 0;
+    struct timespec interval = { 0, LOG_FLUSH_MS * 1000000 };
+    (void)arg;
     
-    for (i = 0; i <= dataLen; i++)
+    while (1)
     {
-        chkSum = chkSum + data[i];
+        if (log_Drain()) continue;
+        if (!__atomic_load_n(&log_Ring.running, __ATOMIC_ACQUIRE)) break;
+        nanosleep(&interval, NULL);
     }
-    return chkSum;
+    return NULL;
 }
 
 
-Solax_ErrorQuery_t solax_RS485_Send(Solax_Message_t* txMessage)
+/* --- Messages logged before the writer is started are kept in the ring --- */
+void log_Init(void)
 {
-    int txLen;
-    uint8_t msgLen;
-    uint16_t crc;
-    
-    txMessage->Header[0] = 0xAA;
-    txMessage->Header[1] = 0x55;
-    
-    msgLen = txMessage->DataLength + 9;
-    crc = solax_CalculateCRC((const uint8_t*)txMessage, msgLen - 1);    // calculate out crc bytes
-    
-    txMessage->Data[txMessage->DataLength + 0] = highByte(crc);
-    txMessage->Data[txMessage->DataLength + 1] =  lowByte(crc);
-    msgLen += 2;
-    
-    txLen = write(fd_tty, txMessage, msgLen);
-    //tcdrain(fd_tty);    /* delay for output */   // ??????????
-    
-    if (txLen != msgLen)
-    {
-        ERROR_MESSAGE("ComTx: Error transmitting data: %s", strerror(errno));
-        return -1;
-    }
+    uint32_t i;
     
-    if (arg_LogLevel >= LOG_TRACE)
+    for (i = 0; i < LOG_RING_SIZE; i++)
     {
-        char buff[(3 * sizeof(Solax_Message_t)) + (sizeof(Solax_Message_t) / 8) + 3];
-        log_Bin2Hex(buff, (const uint8_t*)txMessage, msgLen);
-        TRACE_MESSAGE("ComTx:%s", buff);
+        log_Ring.slots[i].sequence = i;
     }
-    
-    return ERR_NONE;
 }
 
 
-Solax_ErrorQuery_t solax_RS485_Receive(Solax_Message_t* rxMessage)
+int log_Start(FILE* fp)
 {
-    int rxLen; // read length
-    uint8_t msgLen;
-    uint16_t crc;
-    
-    rxLen = read(fd_tty, rxMessage, sizeof(Solax_Message_t));
+    sigset_t mask, maskPrevious;
+    int error;
     
-    // Test-Mode: Simulation of inverter data
-    if (arg_TestMode)
-    {
-        static int x = 0;
-        static const uint8_t rx_msg_1[] = {0xAA, 0x55, 0x00, 0xFF, 0x01, 0x00, 0x10, 0x80, 0x0E, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x37, 0x36, 0x35, 0x34, 0x33, 0x32, 0x31, 0x05, 0x75};
-        static const uint8_t rx_msg_2[] = {0xAA, 0x55, 0x00, 0x0A, 0x00, 0x00, 0x10, 0x81, 0x01, 0x06, 0x01, 0xA1};
-        static const uint8_t rx_msg_3[] = {0xAA, 0x55, 0x00, 0x0A, 0x01, 0x00, 0x11, 0x82, 0x32, 0x00, 0x0B, 0x00, 0x01, 0x06, 0xDD, 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00, 0x15, 0x09, 0x21, 0x13, 0x87, 0x01, 0xE7, 0xFF, 0xFF, 0x00, 0x00, 0x12, 0xD3, 0x00, 0x00, 0x0A, 0x0F, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07, 0x9C};
-        static const uint8_t rx_msg_4[] = {0xAA, 0x55, 0x00, 0x0A, 0x01, 0x00, 0x11, 0x82, 0x32, 0x00, 0x0B, 0x00, 0x01, 0x06, 0xCB, 0x00, 0x00, 0x00, 0x1E, 0x00, 0x00, 0x00, 0x14, 0x09, 0x22, 0x13, 0x89, 0x01, 0xD7, 0xFF, 0xFF, 0x00, 0x00, 0x12, 0xD3, 0x00, 0x00, 0x0A, 0x0F, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07, 0x7B};
-        if (x == 1) {rxLen = sizeof(rx_msg_1); memcpy(rxMessage, rx_msg_1, rxLen);}
-        if (x == 2) {rxLen = sizeof(rx_msg_2); memcpy(rxMessage, rx_msg_2, rxLen);}
-        if (x == 3) {rxLen = sizeof(rx_msg_3); memcpy(rxMessage, rx_msg_3, rxLen);}
-        if (x == 4) {rxLen = sizeof(rx_msg_4); memcpy(rxMessage, rx_msg_4, rxLen);}
-        x++; if (x > 4) {x = 3;}
-    }
+    log_Ring.fd = fileno(fp);
+    log_Ring.running = true;
     
-    if (rxLen < 0)
+    // all signals are handled by the main thread
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, &maskPrevious);
+    error = pthread_create(&log_Ring.thread, NULL, log_Writer, NULL);
+    pthread_sigmask(SIG_SETMASK, &maskPrevious, NULL);
+    if (error)
     {
-        ERROR_MESSAGE("ComRx: Error receiving data: %s", strerror(errno));
+        log_Ring.running = false;
+        fprintf(stderr, "Main: Error starting log writer: %s\n", strerror(error));
         return -1;
     }
+    return 0;
+}
+
+
+/* --- Write the remaining messages at exit --- */
+void log_Stop(void)
+{
+    if (!log_Ring.running) return;
     
-    if (arg_LogLevel >= LOG_TRACE)
-    {
-        char buff[(3 * sizeof(Solax_Message_t)) + (sizeof(Solax_Message_t) / 8) + 3];
-        log_Bin2Hex(buff, (const uint8_t*)rxMessage, rxLen);
-        TRACE_MESSAGE("ComRx:%s", buff);
-    }
+    __atomic_store_n(&log_Ring.running, false, __ATOMIC_RELEASE);
+    pthread_join(log_Ring.thread, NULL);
+}
+
+
+/* --- Open the Log-File again, e.g. after logrotate, path NULL = stderr --- */
+int log_Reopen(const char path[])
+{
+    FILE* fp = stderr;
     
-    if (rxLen == 0)
+    if (path != NULL)
     {
-        return ERR_NO_DATA;
+        fp = fopen(path, "a");
+        if (fp == NULL) { ERROR_MESSAGE("Main: Error opening Log-File '%s': %s", path, strerror(errno)); return -1; }
     }
     
-    if ((rxLen < 11) || (rxMessage->Header[0] != 0xAA) || (rxMessage->Header[1] != 0x55))
+    if ((fp != stderr) && (fp_log_file != stderr))
     {
-        TRACE_MESSAGE("ComRx: Header fail");
-        return ERR_INVALID_MSG;
+        // the descriptor of the writer refers to the new file from now on, it is never closed while in use
+        dup2(fileno(fp), log_Ring.fd);
+        fclose(fp);
+        return 0;
     }
     
-    msgLen = rxMessage->DataLength + 9;
+    // from or to stderr: the file used until now stays open, the writer could still write a batch to it
+    __atomic_store_n(&log_Ring.fd, fileno(fp), __ATOMIC_RELEASE);
+    fp_log_file = fp;
+    return 0;
+}
+
+
+
+/* --- Hex dump of a frame, " XX XX ... " with one more space in front of each 8 bytes --- */
+int log_Bin2Hex(char buff[], const uint8_t data[], const uint8_t dataLen)
+{
+    static const char digits[16] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
+    char* out = buff;
+    int i;
+    
+    if (dataLen == 0) return sprintf(buff, " No Data");
     
-    if ((msgLen + 2) > rxLen)
+    for (i = 0; i < dataLen; i++)
     {
-        TRACE_MESSAGE("ComRx: Length fail");
-        return ERR_INVALID_MSG;
+        if ((i % 8) == 0) *out++ = ' ';
+        *out++ = digits[data[i] >> 4];
+        *out++ = digits[data[i] & 0x0F];
+        *out++ = ' ';
     }
+    *out = '\0';
+    return out - buff;
+}
+
+
+/* --- (Re)start a timer, value_ms = 0 stops it, interval_ms = 0 for a one-shot timer --- */
+int timer_Set(int fd, int value_ms, int interval_ms)
+{
+    struct itimerspec timerSpec = {0};
     
-    crc = solax_CalculateCRC((const uint8_t*)rxMessage, msgLen - 1);  // calculate out crc bytes
+    timerSpec.it_value.tv_sec     = value_ms / 1000;
+    timerSpec.it_value.tv_nsec    = (value_ms % 1000) * 1000000L;
+    timerSpec.it_interval.tv_sec  = interval_ms / 1000;
+    timerSpec.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
     
-    // check calc crc with received crc
-    if (rxMessage->Data[rxMessage->DataLength + 0] != highByte(crc) ||
-        rxMessage->Data[rxMessage->DataLength + 1] != lowByte(crc))
+    if (timerfd_settime(fd, 0, &timerSpec, NULL) == -1)
     {
-        return ERR_CRC_ERROR;
+        ERROR_MESSAGE("Timer: Error setting timer: %s", strerror(errno));
+        return -1;
     }
+    return 0;
+}
 
-    return ERR_NONE;
+
+/* --- Metrics: counters and histograms for /metrics --- */
+double metrics_Now(void)
+{
+    struct timespec timeNow;
+    
+    if (replay_File.fast) return replay_File.clock / 1e9;
+    clock_gettime(CLOCK_MONOTONIC, &timeNow);
+    return timeNow.tv_sec + timeNow.tv_nsec / 1e9;
 }
 
 
-Solax_ErrorQuery_t solax_Send_Broardcast()
+void metrics_Observe(Metrics_Histogram_t* histogram, double value)
 {
-    static Solax_Message_t txMessage;
+    int i;
     
-    txMessage.Source[0] = 0x01;
-    txMessage.Source[1] = 0x00;
-    txMessage.Destination[0] = 0x00;
-    txMessage.Destination[1] = 0x00;
-    txMessage.ControlCode = 0x10;
-    txMessage.FunctionCode = 0x00;
-    txMessage.DataLength = 0x00;
+    double sum;
+    
+    for (i = 0; (i < METRICS_BUCKET_COUNT) && (value > histogram->bounds[i]); i++);
     
-    return solax_RS485_Send(&txMessage);
+    // atomic, the histogram of the HTTP threads is shared
+    __atomic_fetch_add(&histogram->count[i], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->total, 1, __ATOMIC_RELAXED);
+    __atomic_load(&histogram->sum, &sum, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange(&histogram->sum, &sum, &(double){ sum + value }, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
 }
 
 
-Solax_ErrorQuery_t solax_Send_InverterAddress()
+/* --- Timing of the serial exchanges: query written, first response byte, frame completed --- */
+int64_t timing_Now(void)
 {
-    static Solax_Message_t txMessage;
-    
-    txMessage.Source[0] = 0x00;
-    txMessage.Source[1] = 0x00;
-    txMessage.Destination[0] = 0x00;
-    txMessage.Destination[1] = 0x00;
-    txMessage.ControlCode = 0x10;
-    txMessage.FunctionCode = 0x01;
-    txMessage.DataLength = 0x0F;
-    memcpy(txMessage.Data, solax_InverterSerialNumber, 14);
-    txMessage.Data[14] = arg_InverterAddr;
+    struct timespec timeNow;
     
-    return solax_RS485_Send(&txMessage);
+    if (replay_File.fast) return replay_File.clock;
+    clock_gettime(CLOCK_MONOTONIC, &timeNow);
+    return (int64_t)timeNow.tv_sec * 1000000000 + timeNow.tv_nsec;
 }
 
 
-Solax_ErrorQuery_t solax_Send_QueryLiveData()
+void timing_Begin(Solax_Bus_t* bus, const Solax_Inverter_t* inverter)
 {
-    static Solax_Message_t txMessage;
+    Timing_Record_t* record = &bus->timing;
     
-    txMessage.Source[0] = 0x01;
-    txMessage.Source[1] = 0x00;
-    txMessage.Destination[0] = 0x00;
-    txMessage.Destination[1] = arg_InverterAddr;
-    txMessage.ControlCode = 0x11;
-    txMessage.FunctionCode = 0x02;
-    txMessage.DataLength = 0x00;
+    *record = (Timing_Record_t) {0};
+    record->bus = bus->index;
+    record->address = inverter->Address;
+    record->state = inverter->StateQuery;
+}
+
+
+/* publish the record, the exchanges of all buses share the ring in the order they are finished */
+void timing_End(Solax_Bus_t* bus, Solax_ErrorQuery_t result)
+{
+    Timing_Record_t* record = &timing_Ring.records[timing_Ring.written & (TIMING_RECORD_COUNT - 1)];
     
-    return solax_RS485_Send(&txMessage);
+    bus->timing.result = result;
+    bus->timing.endTime = timing_Now();
+    bus->timing.sequence = timing_Ring.written;
+    *record = bus->timing;
+    __atomic_store_n(&timing_Ring.written, timing_Ring.written + 1, __ATOMIC_RELEASE);
 }
 
 
-Solax_ErrorQuery_t solax_SendQuery(const Solax_StateQuery_t stateQuery)
+/* returns false if the record was overwritten while copying */
+bool timing_Read(uint32_t sequence, Timing_Record_t* record)
 {
-    Solax_ErrorQuery_t error;
+    *record = timing_Ring.records[sequence & (TIMING_RECORD_COUNT - 1)];
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (record->sequence == sequence) && (__atomic_load_n(&timing_Ring.written, __ATOMIC_ACQUIRE) - sequence < TIMING_RECORD_COUNT);
+}
+
+
+/* --- Summary of the timing ring to the log, on SIGUSR1 --- */
+void timing_Dump(void)
+{
+    Timing_Record_t record;
+    uint32_t written = __atomic_load_n(&timing_Ring.written, __ATOMIC_ACQUIRE);
+    uint32_t sequence = (written >= TIMING_RECORD_COUNT) ? written - TIMING_RECORD_COUNT + 1 : 0;
+    double first, frame;
+    double firstMin = 1e9, firstMax = 0, firstSum = 0;
+    double frameMin = 1e9, frameMax = 0, frameSum = 0;
+    int count = 0, countFirst = 0, countFrame = 0;
     
-    switch (stateQuery)
+    for (; sequence < written; sequence++)
     {
-        case STATE_BROARDCAST:
-        {
-            error = solax_Send_Broardcast();
-            break;
-        }
-        
-        case STATE_INVERTER_ADDRESS:
+        if (!timing_Read(sequence, &record)) continue;
+        count++;
+        if (record.rxFirstTime)
         {
-            error = solax_Send_InverterAddress();
-            break;
+            first = (record.rxFirstTime - record.txTime) / 1e6;
+            if (first < firstMin) firstMin = first;
+            if (first > firstMax) firstMax = first;
+            firstSum += first;
+            countFirst++;
         }
-        
-        case STATE_QUERY_LIVE_DATA:
+        if (record.rxFrameTime)
         {
-            error = solax_Send_QueryLiveData();
-            break;
+            frame = (record.rxFrameTime - record.txTime) / 1e6;
+            if (frame < frameMin) frameMin = frame;
+            if (frame > frameMax) frameMax = frame;
+            frameSum += frame;
+            countFrame++;
         }
     }
-    return error;
+    
+    NOTICE_MESSAGE("Timing: %d exchanges, %d with response, %d with frame", count, countFirst, countFrame);
+    if (countFirst) NOTICE_MESSAGE("Timing: First byte after %.1f / %.1f / %.1f ms (min / avg / max)", firstMin, firstSum / countFirst, firstMax);
+    if (countFrame) NOTICE_MESSAGE("Timing: Frame completed after %.1f / %.1f / %.1f ms (min / avg / max)", frameMin, frameSum / countFrame, frameMax);
 }
 
 
-Solax_ErrorQuery_t solax_ReceiveQuery(const Solax_StateQuery_t stateQuery, Solax_LiveData_t* liveData)
+int init_Event_Handler(Event_Handler_t* handler, uint32_t events)
 {
-    static Solax_Message_t rxMessage;
+    struct epoll_event event = {0};
     
-    uint32_t value;
-    Solax_ErrorQuery_t error;
-        
-    error = solax_RS485_Receive(&rxMessage);
-    if (error == -1) return -1;
+    event.events = events;
+    event.data.ptr = handler;
     
-    *liveData = (Solax_LiveData_t) {0};
-        
-    switch (stateQuery)
+    if (epoll_ctl(fd_epoll, EPOLL_CTL_ADD, handler->fd, &event) == -1)
     {
-        case STATE_BROARDCAST:
+        ERROR_MESSAGE("Init: Error adding file descriptor '%d' to event loop: %s", handler->fd, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+
+int init_Event_Loop(void)
+{
+    fd_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (fd_epoll == -1) { ERROR_MESSAGE("Init: Error creating event loop: %s", strerror(errno)); return -1; }
+    
+    return 0;
+}
+
+
+uint16_t solax_CalculateCRC(const uint8_t data[], const uint8_t dataLen)
+{
+    uint8_t i;
+    uint16_t chkSum = 0;
+    
+    for (i = 0; i <= dataLen; i++)
+    {
+        chkSum = chkSum + data[i];
+    }
+    return chkSum;
+}
+
+
+/* --- Streaming reassembly of received frames --- */
+#define FRAMER_BYTE(f, i)    ((f)->buffer[((f)->head + (i)) & (FRAMER_BUFFER_SIZE - 1)])
+
+void solax_Framer_Reset(Solax_Framer_t* framer)
+{
+    *framer = (Solax_Framer_t) {0};
+}
+
+
+void solax_Framer_Drop(Solax_Framer_t* framer, uint16_t len)
+{
+    framer->head = (framer->head + len) & (FRAMER_BUFFER_SIZE - 1);
+    framer->count -= len;
+    framer->frameLength = 0;
+    framer->scanned = 0;
+    framer->checksum = 0;
+}
+
+
+void solax_Framer_Write(Solax_Framer_t* framer, const uint8_t data[], int dataLen)
+{
+    int i;
+    
+    for (i = 0; (i < dataLen) && (framer->count < FRAMER_BUFFER_SIZE); i++)
+    {
+        FRAMER_BYTE(framer, framer->count) = data[i];
+        framer->count++;
+    }
+}
+
+
+int solax_Framer_Read(Solax_Framer_t* framer, int fd)
+{
+    struct iovec iov[2];
+    uint16_t tail, space;
+    int rxLen;
+    
+    space = FRAMER_BUFFER_SIZE - framer->count;
+    if (space == 0) return 0;
+    
+    // free space of the ring buffer could be wrapped around
+    tail = (framer->head + framer->count) & (FRAMER_BUFFER_SIZE - 1);
+    iov[0].iov_base = &framer->buffer[tail];
+    iov[0].iov_len  = (tail + space > FRAMER_BUFFER_SIZE) ? (FRAMER_BUFFER_SIZE - tail) : space;
+    iov[1].iov_base = &framer->buffer[0];
+    iov[1].iov_len  = space - iov[0].iov_len;
+    
+    rxLen = readv(fd, iov, iov[1].iov_len ? 2 : 1);
+    if (rxLen < 0)
+    {
+        if (errno == EAGAIN) return 0;
+        return -1;
+    }
+    framer->count += rxLen;
+    return rxLen;
+}
+
+
+/* returns ERR_NONE or ERR_CRC_ERROR with the frame copied to message, ERR_INCOMPLETE if more data is needed */
+Solax_ErrorQuery_t solax_Framer_Next(Solax_Framer_t* framer, Solax_Message_t* message, int* messageLen)
+{
+    uint16_t i, crc;
+    
+    while (1)
+    {
+        if (framer->frameLength == 0)
         {
-            if (error == ERR_NO_DATA)
-            {
-                // Maybe the Solax-X1 inverter is offline (e.g. no sunlight);
-                DEBUG_MESSAGE("Solax: No broadcast response");
-            }
-            else if (error == ERR_CRC_ERROR)
-            {
-                DEBUG_MESSAGE("Solax: Broadcast response CRC error");
-            }
-            else if ((error == ERR_INVALID_MSG) || (rxMessage.ControlCode != 0x10) || (rxMessage.FunctionCode != 0x80))
+            // resync on header 0xAA 0x55
+            while ((framer->count >= 1) && ((FRAMER_BYTE(framer, 0) != 0xAA) || ((framer->count >= 2) && (FRAMER_BYTE(framer, 1) != 0x55))))
             {
-                DEBUG_MESSAGE("Solax: Invalid broadcast response message");
+                solax_Framer_Drop(framer, 1);
+                framer->discarded++;
             }
-            else
+            if (framer->count < offsetof(Solax_Message_t, Data)) return ERR_INCOMPLETE;
+            
+            if (FRAMER_BYTE(framer, offsetof(Solax_Message_t, DataLength)) > (sizeof(message->Data) - 2))
             {
-                // Serial number from query response
-                memcpy(solax_InverterSerialNumber, rxMessage.Data, 14);
-                solax_InverterSerialNumber[14] = '\0';
-                DEBUG_MESSAGE("Solax: Serial number: %s", solax_InverterSerialNumber);
+                solax_Framer_Drop(framer, 1);   // invalid length, search next header
+                framer->discarded++;
+                continue;
             }
-            break;
+            framer->frameLength = FRAMER_BYTE(framer, offsetof(Solax_Message_t, DataLength)) + 11;
         }
         
-        case STATE_INVERTER_ADDRESS:
+        // checksum over all bytes in front of the crc bytes
+        while ((framer->scanned < framer->frameLength - 2) && (framer->scanned < framer->count))
         {
-            if (error == ERR_NO_DATA)
-            {
-                DEBUG_MESSAGE("Solax: No address confirmation response");
-            }
-            else if (error == ERR_CRC_ERROR)
-            {
-                DEBUG_MESSAGE("Solax: Address confirmation response CRC error");
-            }
-            else if ((error == ERR_INVALID_MSG) || (rxMessage.ControlCode != 0x10) || (rxMessage.FunctionCode != 0x81) || (rxMessage.Data[0] != 0x06))
-            {
-                DEBUG_MESSAGE("Solax: Invalid address confirmation message");
-            }
-            else
-            {
-                DEBUG_MESSAGE("Solax: Inverter Bus-Address 0x%02X confirmed", arg_InverterAddr);
-            }
-            break;
+            framer->checksum += FRAMER_BYTE(framer, framer->scanned);
+            framer->scanned++;
         }
+        if (framer->count < framer->frameLength) return ERR_INCOMPLETE;
         
-        case STATE_QUERY_LIVE_DATA:
+        for (i = 0; i < framer->frameLength; i++)
         {
-            if (error == ERR_NO_DATA)
-            {
-                DEBUG_MESSAGE("Solax: No live data response");
-            }
-            else if (error == ERR_CRC_ERROR)
-            {
-                DEBUG_MESSAGE("Solax: Data response CRC error");
-            }
-            else if ((error == ERR_INVALID_MSG) || (rxMessage.ControlCode != 0x11) || (rxMessage.FunctionCode != 0x82))
-            {
-                DEBUG_MESSAGE("Solax: Invalid live data message");
-            }
-            else
-            {
-                value = (rxMessage.Data[0] << 8) | rxMessage.Data[1]; // Temperature [C]
-                liveData->Temperature = value;
-                DEBUG_MESSAGE("Solax: LiveData.Temperature: %.0f C", liveData->Temperature);
-                
-                value = (rxMessage.Data[2] << 8) | rxMessage.Data[3]; // Energy Today [kWh]
-                liveData->Energy_Today = value * 0.1f;
-                DEBUG_MESSAGE("Solax: LiveData.Energy_Today: %.1f kWh", liveData->Energy_Today);
-                
-                value = (rxMessage.Data[4] << 8) | rxMessage.Data[5]; // PV1 Voltage [V]
-                liveData->DC1_Voltage = value * 0.1f;
-                DEBUG_MESSAGE("Solax: LiveData.DC1_Voltage: %.1f V", liveData->DC1_Voltage);
-                
-                value = (rxMessage.Data[6] << 8) | rxMessage.Data[7]; // PV2 Voltage [V]
-                liveData->DC2_Voltage = value * 0.1f;
-                DEBUG_MESSAGE("Solax: LiveData.DC2_Voltage: %.1f V", liveData->DC2_Voltage);
-                
-                value = (rxMessage.Data[8] << 8) | rxMessage.Data[9]; // PV1 Current [A]
-                liveData->DC1_Current = value * 0.1f;
-                DEBUG_MESSAGE("Solax: LiveData.DC1_Current: %.1f A", liveData->DC1_Current);
-                
-                value = (rxMessage.Data[10] << 8) | rxMessage.Data[11]; // PV2 Current [A]
-                liveData->DC2_Current = value * 0.1f;
-                DEBUG_MESSAGE("Solax: LiveData.DC2_Current: %.1f A", liveData->DC2_Current);
-                
-                value = (rxMessage.Data[12] << 8) | rxMessage.Data[13]; // AC Current [A]
-                liveData->AC_Current = value * 0.1f;
-                DEBUG_MESSAGE("Solax: LiveData.AC_Current: %.1f A", liveData->AC_Current);
-                
-                value = (rxMessage.Data[14] << 8) | rxMessage.Data[15]; // AC Voltage [V]
-                liveData->AC_Voltage = value * 0.1f;
-                DEBUG_MESSAGE("Solax: LiveData.AC_Voltage: %.1f V", liveData->AC_Voltage);
-                
-                value = (rxMessage.Data[16] << 8) | rxMessage.Data[17]; // AC Frequency [Hz]
-                liveData->Frequency = value * 0.01f;
-                DEBUG_MESSAGE("Solax: LiveData.Frequency: %.2f Hz", liveData->Frequency);
-                
-                value = (rxMessage.Data[18] << 8) | rxMessage.Data[19]; // AC Power [W]
-                liveData->Power = value;
-                DEBUG_MESSAGE("Solax: LiveData.Power: %.0f W", liveData->Power);
-                
-                //value = (rxMessage.Data[20] << 8) | rxMessage.Data[21]; // Not Used
-                
-                value = (rxMessage.Data[22] << 24) | (rxMessage.Data[23] << 16) | (rxMessage.Data[24] << 8) | rxMessage.Data[25]; // Energy Total [kWh]
-                if (value) {liveData->Energy_Total = value * 0.1f;}
-                DEBUG_MESSAGE("Solax: LiveData.Energy_Total: %.1f kWh", liveData->Energy_Total);
-                
-                value = (rxMessage.Data[26] << 24) | (rxMessage.Data[27] << 16) | (rxMessage.Data[28] << 8) | rxMessage.Data[29]; // Work Time Total [hour]
-                if (value) {liveData->Runtime_Total = value;}
-                DEBUG_MESSAGE("Solax: LiveData.Runtime_Total: %.0f h", liveData->Runtime_Total);
-                
-                value = (rxMessage.Data[30] << 8) | rxMessage.Data[31]; // Work mode [???]
-                liveData->Status = (uint8_t)value;
-                DEBUG_MESSAGE("Solax: LiveData.Status: %d", liveData->Status);
-                
-                //value = (rxMessage.Data[32] << 8) | rxMessage.Data[33]; // Grid voltage fault in 0.1V
-                //value = (rxMessage.Data[34] << 8) | rxMessage.Data[35]; // Gird frequency fault in 0.01Hz
-                //value = (rxMessage.Data[36] << 8) | rxMessage.Data[37]; // DC injection fault in 1mA
-                //value = (rxMessage.Data[38] << 8) | rxMessage.Data[39]; // Temperature fault in C
-                //value = (rxMessage.Data[40] << 8) | rxMessage.Data[41]; // Pv1 voltage fault in 0.1V
-                //value = (rxMessage.Data[42] << 8) | rxMessage.Data[43]; // Pv2 voltage fault in 0.1V
-                //value = (rxMessage.Data[44] << 8) | rxMessage.Data[45]; // GFC fault
-                
-                value = (rxMessage.Data[49] << 24) | (rxMessage.Data[48] << 16) | (rxMessage.Data[47] << 8) | rxMessage.Data[46]; // Error Code
-                liveData->ErrorBits = (uint32_t)value;
-                DEBUG_MESSAGE("Solax: LiveData.ErrorBits: 0x%08X", liveData->ErrorBits);
-                
-                liveData->valid = true;
-            }
-            break;
+            ((uint8_t*)message)[i] = FRAMER_BYTE(framer, i);
         }
+        *messageLen = framer->frameLength;
+        
+        crc = (FRAMER_BYTE(framer, framer->frameLength - 2) << 8) | FRAMER_BYTE(framer, framer->frameLength - 1);
+        if (crc != framer->checksum)
+        {
+            solax_Framer_Drop(framer, 1);   // maybe a false header, search next header
+            return ERR_CRC_ERROR;
+        }
+        
+        solax_Framer_Drop(framer, *messageLen);
+        return ERR_NONE;
     }
-    return error;
 }
 
 
-/* --- State Machine Communication with Solax-X1_Mini --- */
-int solax_QueryHandle(Solax_LiveData_t* liveData)
+/* --- Capture of the raw bus traffic: every written frame and every read of the bus with its time --- */
+int capture_Open(const char path[])
 {
-    static Solax_StateQuery_t stateQuery = STATE_QUERY_LIVE_DATA;
-    static int timeoutInverterOnline = TIMEOUT_INVERTER_ONLINE;
-    static int countError = 0;
+    Capture_Header_t header = { .magic = "SOLAXCAP", .version = CAPTURE_VERSION };
+    struct timespec timeNow;
     
-    Solax_ErrorQuery_t errorRx;
-    Solax_ErrorQuery_t errorTx;
-        
-    errorRx = solax_ReceiveQuery(stateQuery, liveData);
-    if (errorRx == -1) return -1;
+    fp_capture_file = fopen(path, "w");
+    if (fp_capture_file == NULL) { ERROR_MESSAGE("Init: Error opening capture file '%s': %s", path, strerror(errno)); return -1; }
     
-    switch (stateQuery)
+    clock_gettime(CLOCK_REALTIME, &timeNow);
+    header.realTime = (int64_t)timeNow.tv_sec * 1000000000 + timeNow.tv_nsec;
+    header.monotonicTime = timing_Now();
+    if (fwrite(&header, sizeof(header), 1, fp_capture_file) != 1) { ERROR_MESSAGE("Init: Error writing capture file '%s': %s", path, strerror(errno)); return -1; }
+    
+    NOTICE_MESSAGE("Init: Capturing bus traffic to '%s'", path);
+    return 0;
+}
+
+
+/* buffered by stdio, flushed once per query interval */
+void capture_Write(const Solax_Bus_t* bus, Capture_Direction_t direction, const uint8_t data[], int dataLen)
+{
+    Capture_Record_t record = { .time = timing_Now(), .length = dataLen, .direction = direction, .bus = bus->index };
+    
+    if (fp_capture_file == NULL) return;
+    
+    fwrite(&record, sizeof(record), 1, fp_capture_file);
+    fwrite(data, 1, dataLen, fp_capture_file);
+}
+
+
+/* --- Replay of a capture: the recorded responses are written to a socket pair used instead of the serial interface --- */
+/* only the traffic of the first bus of the capture is replayed */
+void replay_Read(Replay_t* replay)
+{
+    do
     {
-        case STATE_BROARDCAST:
-        {
-            if (errorRx)
-            {
-                countError++;
-                if (countError >= 10)
-                {
-                    countError = 0;
-                    stateQuery = STATE_QUERY_LIVE_DATA;
-                }
-            }
-            else
-            {
-                countError = 0;
-                stateQuery = STATE_INVERTER_ADDRESS;
-            }
-            break;
-        }
-        
-        case STATE_INVERTER_ADDRESS:
+        if ((fread(&replay->next, sizeof(replay->next), 1, replay->fp) != 1) ||
+            (replay->next.length > CAPTURE_DATA_SIZE) ||
+            (fread(replay->data, 1, replay->next.length, replay->fp) != replay->next.length))
         {
-            if (errorRx)
-            {
-                countError++;
-                if (countError >= 3)
-                {
-                    countError = 0;
-                    stateQuery = STATE_BROARDCAST;
-                }
-            }
-            else
-            {
-                countError = 0;
-                stateQuery = STATE_QUERY_LIVE_DATA;
-            }
-            break;
+            if (!replay->done) NOTICE_MESSAGE("Replay: End of capture after %llu exchanges", (unsigned long long)replay->exchanges);
+            replay->done = true;
         }
-        
-        case STATE_QUERY_LIVE_DATA:
-        {
-            if (errorRx)
-            {
-                countError++;
-                if (countError >= 3)
-                {
-                    countError = 0;
-                    stateQuery = STATE_BROARDCAST;
-                }
-            }
-            else
-            {
-                timeoutInverterOnline = 0;
-            }
-            break;
+    }
+    while (!replay->done && (replay->next.bus != 0));
+}
+
+
+void replay_Deliver(Replay_t* replay)
+{
+    if (write(replay->peer, replay->data, replay->next.length) != replay->next.length)
+    {
+        ERROR_MESSAGE("Replay: Error writing %d bytes: %s", replay->next.length, strerror(errno));
+    }
+    replay->clock = replay->next.time;
+    replay_Read(replay);
+}
+
+
+/* real time: arm the timer for the next response data of the replayed query */
+int replay_Schedule(Replay_t* replay)
+{
+    int64_t delay;
+    
+    if (replay->done || (replay->next.direction != CAPTURE_RX)) return timer_Set(replay->handler.fd, 0, 0);
+    
+    delay = (replay->next.time - replay->txTime) - (timing_Now() - replay->queryTime);
+    return timer_Set(replay->handler.fd, (delay > 1000000) ? (delay + 999999) / 1000000 : 1, 0);
+}
+
+
+/* --- Called for each query, the next query of the capture is replayed --- */
+int replay_Query(Replay_t* replay)
+{
+    uint8_t buff[sizeof(Solax_Message_t)];
+    
+    while (read(replay->peer, buff, sizeof(buff)) > 0);    // the query written by solaXd
+    
+    // responses of the last query not delivered until now are late
+    while (!replay->done && (replay->next.direction != CAPTURE_TX)) replay_Read(replay);
+    if (replay->done) return 0;
+    
+    replay->txTime = replay->next.time;
+    replay->clock = replay->txTime;
+    replay->queryTime = timing_Now();
+    replay->exchanges++;
+    replay_Read(replay);
+    
+    if (replay->fast) return 0;    // delivered by replay_Run()
+    return replay_Schedule(replay);
+}
+
+
+int poll_Replay_Timer(Event_Handler_t* handler, uint32_t events)
+{
+    Replay_t* replay = (Replay_t*)handler;
+    uint64_t expirations;
+    (void)events;
+    
+    if (read(handler->fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return 0;
+    
+    while (!replay->done && (replay->next.direction == CAPTURE_RX) &&
+           (replay->next.time - replay->txTime <= timing_Now() - replay->queryTime))
+    {
+        replay_Deliver(replay);
+    }
+    return replay_Schedule(replay);
+}
+
+
+int replay_Open(Replay_t* replay, Solax_Bus_t* bus, const char path[], bool fast)
+{
+    Capture_Header_t header;
+    int sv[2];
+    
+    replay->fp = fopen(path, "r");
+    if (replay->fp == NULL) { ERROR_MESSAGE("Init: Error opening capture file '%s': %s", path, strerror(errno)); return -1; }
+    
+    if ((fread(&header, sizeof(header), 1, replay->fp) != 1) || (memcmp(header.magic, "SOLAXCAP", 8) != 0) || (header.version != CAPTURE_VERSION))
+    {
+        ERROR_MESSAGE("Init: '%s' is no capture file", path);
+        errno = EINVAL;
+        return -1;
+    }
+    
+    // solaXd reads and writes the socket as if it were the serial interface of the bus
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) == -1) { ERROR_MESSAGE("Init: Error creating socket pair: %s", strerror(errno)); return -1; }
+    bus->handler.fd = sv[0];
+    replay->peer = sv[1];
+    
+    replay->handler.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (replay->handler.fd == -1) { ERROR_MESSAGE("Init: Error creating replay timer: %s", strerror(errno)); return -1; }
+    replay->handler.callback = poll_Replay_Timer;
+    
+    replay->fast = fast;
+    replay->clock = header.monotonicTime;
+    replay_Read(replay);
+    
+    NOTICE_MESSAGE("Init: Replaying capture '%s' %s", path, fast ? "as fast as possible" : "in real time");
+    return 0;
+}
+
+
+/* read and write errors end the daemon, unless the transport of the bus reconnects */
+int solax_Transport_Error(Solax_Bus_t* bus, const char message[])
+{
+    if (bus->transport->error != NULL) return bus->transport->error(bus, message);
+    
+    ERROR_MESSAGE("%s '%s': %s", message, bus->device, strerror(errno));
+    return -1;
+}
+
+
+Solax_ErrorQuery_t solax_RS485_Send(Solax_Bus_t* bus, Solax_Message_t* txMessage)
+{
+    int txLen;
+    uint8_t msgLen;
+    uint16_t crc;
+    
+    txMessage->Header[0] = 0xAA;
+    txMessage->Header[1] = 0x55;
+    
+    msgLen = txMessage->DataLength + 9;
+    crc = solax_CalculateCRC((const uint8_t*)txMessage, msgLen - 1);    // calculate out crc bytes
+    
+    txMessage->Data[txMessage->DataLength + 0] = highByte(crc);
+    txMessage->Data[txMessage->DataLength + 1] =  lowByte(crc);
+    msgLen += 2;
+    
+    bus->timing.txTime = timing_Now();
+    if (bus->handler.fd < 0) return ERR_NONE;    // not connected, the query times out
+    
+    txLen = bus->transport->write(bus, txMessage, msgLen);
+    //tcdrain(bus->handler.fd);    /* delay for output */   // ??????????
+    
+    if (txLen != msgLen) return solax_Transport_Error(bus, "ComTx: Error transmitting data to");
+    metrics_Data.txFrames++;
+    capture_Write(bus, CAPTURE_TX, (const uint8_t*)txMessage, msgLen);
+    bus->timing.txTime = timing_Now();
+    bus->timing.txBytes = msgLen;
+    
+    if ((arg_LogLevel >= LOG_TRACE) && bus->queryTrace)
+    {
+        char buff[(3 * sizeof(Solax_Message_t)) + (sizeof(Solax_Message_t) / 8) + 3];
+        log_Bin2Hex(buff, (const uint8_t*)txMessage, msgLen);
+        TRACE_MESSAGE("ComTx:%s", buff);
+    }
+    
+    return ERR_NONE;
+}
+
+
+Solax_ErrorQuery_t solax_RS485_Receive(Solax_Bus_t* bus, Solax_Message_t* rxMessage, bool timeout)
+{
+    Solax_Framer_t* framer = &bus->framer;
+    int rxLen = 0; // frame length
+    Solax_ErrorQuery_t error;
+    
+    rxLen = (bus->handler.fd >= 0) ? solax_Framer_Read(framer, bus->handler.fd) : 0;
+    if (rxLen < 0)
+    {
+        if (solax_Transport_Error(bus, "ComRx: Error receiving data from") == -1) return -1;
+        rxLen = 0;
+    }
+    metrics_Data.rxBytes += rxLen;
+    bus->timing.rxBytes += rxLen;
+    if ((rxLen > 0) && (fp_capture_file != NULL))
+    {
+        uint8_t data[FRAMER_BUFFER_SIZE];
+        int i;
+        for (i = 0; i < rxLen; i++) data[i] = FRAMER_BYTE(framer, framer->count - rxLen + i);
+        capture_Write(bus, CAPTURE_RX, data, rxLen);
+    }
+    if ((rxLen > 0) && (bus->timing.rxFirstTime == 0)) bus->timing.rxFirstTime = timing_Now();
+    
+    // Test-Mode: Simulation of inverter data
+    if (arg_TestMode && timeout)
+    {
+        static int x = 0;
+        static const uint8_t rx_msg_1[] = {0xAA, 0x55, 0x00, 0xFF, 0x01, 0x00, 0x10, 0x80, 0x0E, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x37, 0x36, 0x35, 0x34, 0x33, 0x32, 0x31, 0x05, 0x75};
+        static const uint8_t rx_msg_2[] = {0xAA, 0x55, 0x00, 0x0A, 0x00, 0x00, 0x10, 0x81, 0x01, 0x06, 0x01, 0xA1};
+        static const uint8_t rx_msg_3[] = {0xAA, 0x55, 0x00, 0x0A, 0x01, 0x00, 0x11, 0x82, 0x32, 0x00, 0x0B, 0x00, 0x01, 0x06, 0xDD, 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00, 0x15, 0x09, 0x21, 0x13, 0x87, 0x01, 0xE7, 0xFF, 0xFF, 0x00, 0x00, 0x12, 0xD3, 0x00, 0x00, 0x0A, 0x0F, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07, 0x9C};
+        static const uint8_t rx_msg_4[] = {0xAA, 0x55, 0x00, 0x0A, 0x01, 0x00, 0x11, 0x82, 0x32, 0x00, 0x0B, 0x00, 0x01, 0x06, 0xCB, 0x00, 0x00, 0x00, 0x1E, 0x00, 0x00, 0x00, 0x14, 0x09, 0x22, 0x13, 0x89, 0x01, 0xD7, 0xFF, 0xFF, 0x00, 0x00, 0x12, 0xD3, 0x00, 0x00, 0x0A, 0x0F, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07, 0x7B};
+        if (x == 1) {solax_Framer_Write(framer, rx_msg_1, sizeof(rx_msg_1)); capture_Write(bus, CAPTURE_RX, rx_msg_1, sizeof(rx_msg_1));}
+        if (x == 2) {solax_Framer_Write(framer, rx_msg_2, sizeof(rx_msg_2)); capture_Write(bus, CAPTURE_RX, rx_msg_2, sizeof(rx_msg_2));}
+        if (x == 3) {solax_Framer_Write(framer, rx_msg_3, sizeof(rx_msg_3)); capture_Write(bus, CAPTURE_RX, rx_msg_3, sizeof(rx_msg_3));}
+        if (x == 4) {solax_Framer_Write(framer, rx_msg_4, sizeof(rx_msg_4)); capture_Write(bus, CAPTURE_RX, rx_msg_4, sizeof(rx_msg_4));}
+        x++; if (x > 4) {x = 3;}
+    }
+    
+    error = solax_Framer_Next(framer, rxMessage, &rxLen);
+    
+    if (error == ERR_INCOMPLETE)
+    {
+        // wait for the rest of the response until the query times out
+        if (!timeout) return ERR_INCOMPLETE;
+        
+        if (arg_LogLevel >= LOG_TRACE)
+        {
+            char buff[(3 * FRAMER_BUFFER_SIZE) + (FRAMER_BUFFER_SIZE / 8) + 3];
+            uint8_t data[FRAMER_BUFFER_SIZE];
+            int i;
+            for (i = 0; i < framer->count; i++) data[i] = FRAMER_BYTE(framer, i);
+            log_Bin2Hex(buff, data, (framer->count > 255) ? 255 : framer->count);
+            TRACE_MESSAGE("ComRx:%s", buff);
+        }
+        
+        if (framer->count)
+        {
+            TRACE_MESSAGE("ComRx: Length fail");
+            return ERR_INVALID_MSG;
+        }
+        if (framer->discarded)
+        {
+            TRACE_MESSAGE("ComRx: Header fail");
+            return ERR_INVALID_MSG;
+        }
+        return ERR_NO_DATA;
+    }
+    
+    // faulty frames are logged also if the exchange is not sampled
+    if ((arg_LogLevel >= LOG_TRACE) && (bus->queryTrace || (error != ERR_NONE)))
+    {
+        char buff[(3 * sizeof(Solax_Message_t)) + (sizeof(Solax_Message_t) / 8) + 3];
+        log_Bin2Hex(buff, (const uint8_t*)rxMessage, rxLen);
+        TRACE_MESSAGE("ComRx:%s", buff);
+    }
+    
+    if (error == ERR_NONE) metrics_Data.rxFrames++;
+    bus->timing.rxFrameTime = timing_Now();
+    
+    if (framer->discarded)
+    {
+        TRACE_MESSAGE("ComRx: %d bytes discarded in front of header", framer->discarded);
+        metrics_Data.rxDiscarded += framer->discarded;
+        framer->discarded = 0;
+    }
+    
+    return error;
+}
+
+
+Solax_ErrorQuery_t solax_Send_Broardcast(Solax_Bus_t* bus)
+{
+    static Solax_Message_t txMessage;
+    
+    txMessage.Source[0] = 0x01;
+    txMessage.Source[1] = 0x00;
+    txMessage.Destination[0] = 0x00;
+    txMessage.Destination[1] = 0x00;
+    txMessage.ControlCode = 0x10;
+    txMessage.FunctionCode = 0x00;
+    txMessage.DataLength = 0x00;
+    
+    return solax_RS485_Send(bus, &txMessage);
+}
+
+
+Solax_ErrorQuery_t solax_Send_InverterAddress(const Solax_Inverter_t* inverter)
+{
+    static Solax_Message_t txMessage;
+    
+    txMessage.Source[0] = 0x00;
+    txMessage.Source[1] = 0x00;
+    txMessage.Destination[0] = 0x00;
+    txMessage.Destination[1] = 0x00;
+    txMessage.ControlCode = 0x10;
+    txMessage.FunctionCode = 0x01;
+    txMessage.DataLength = 0x0F;
+    memcpy(txMessage.Data, inverter->SerialNumber, 14);
+    txMessage.Data[14] = inverter->Address;
+    
+    return solax_RS485_Send(inverter->Bus, &txMessage);
+}
+
+
+Solax_ErrorQuery_t solax_Send_QueryLiveData(const Solax_Inverter_t* inverter)
+{
+    static Solax_Message_t txMessage;
+    
+    txMessage.Source[0] = 0x01;
+    txMessage.Source[1] = 0x00;
+    txMessage.Destination[0] = 0x00;
+    txMessage.Destination[1] = inverter->Address;
+    txMessage.ControlCode = 0x11;
+    txMessage.FunctionCode = 0x02;
+    txMessage.DataLength = 0x00;
+    
+    return solax_RS485_Send(inverter->Bus, &txMessage);
+}
+
+
+Solax_ErrorQuery_t solax_SendQuery(const Solax_Inverter_t* inverter)
+{
+    Solax_ErrorQuery_t error;
+    
+    switch (inverter->StateQuery)
+    {
+        case STATE_BROARDCAST:
+        {
+            error = solax_Send_Broardcast(inverter->Bus);
+            break;
+        }
+        
+        case STATE_INVERTER_ADDRESS:
+        {
+            error = solax_Send_InverterAddress(inverter);
+            break;
+        }
+        
+        case STATE_QUERY_LIVE_DATA:
+        {
+            error = solax_Send_QueryLiveData(inverter);
+            break;
+        }
+    }
+    return error;
+}
+
+
+/* --- Registers of the live data response, the order is used for JSON, MQTT and /metrics --- */
+static const Solax_Register_t solax_Registers[REGISTER_COUNT] =
+{
+    //  name                    unit   prec offs width LE     bits   scale  field                                          column
+    { "temperature",            "C",   0,   0,   2,    false, false, 1.0f,  offsetof(Solax_LiveData_t, Temperature),           0 },
+    { "dc1_voltage",            "V",   1,   4,   2,    false, false, 0.1f,  offsetof(Solax_LiveData_t, DC1_Voltage),           1 },
+    { "dc1_current",            "A",   1,   8,   2,    false, false, 0.1f,  offsetof(Solax_LiveData_t, DC1_Current),           2 },
+    { "dc2_voltage",            "V",   1,   6,   2,    false, false, 0.1f,  offsetof(Solax_LiveData_t, DC2_Voltage),           3 },
+    { "dc2_current",            "A",   1,   10,  2,    false, false, 0.1f,  offsetof(Solax_LiveData_t, DC2_Current),           4 },
+    { "ac_voltage",             "V",   1,   14,  2,    false, false, 0.1f,  offsetof(Solax_LiveData_t, AC_Voltage),            5 },
+    { "ac_current",             "A",   1,   12,  2,    false, false, 0.1f,  offsetof(Solax_LiveData_t, AC_Current),            6 },
+    { "frequency",              "Hz",  2,   16,  2,    false, false, 0.01f, offsetof(Solax_LiveData_t, Frequency),             7 },
+    { "power",                  "W",   0,   18,  2,    false, false, 1.0f,  offsetof(Solax_LiveData_t, Power),                 8 },
+    { "energy_today",           "kWh", 1,   2,   2,    false, false, 0.1f,  offsetof(Solax_LiveData_t, Energy_Today),          9 },
+    { "energy_total",           "kWh", 1,   22,  4,    false, false, 0.1f,  offsetof(Solax_LiveData_t, Energy_Total),          0 },
+    { "runtime_total",          "h",   0,   26,  4,    false, false, 1.0f,  offsetof(Solax_LiveData_t, Runtime_Total),         1 },
+    { "status",                 "",    0,   30,  2,    false, false, 1.0f,  offsetof(Solax_LiveData_t, Status),               10 },
+    { "error_bits",             "",    0,   46,  4,    true,  true,  1.0f,  offsetof(Solax_LiveData_t, ErrorBits),             2 },
+    { "grid_voltage_fault",     "V",   1,   32,  2,    false, false, 0.1f,  offsetof(Solax_LiveData_t, Grid_Voltage_Fault),   11 },
+    { "grid_frequency_fault",   "Hz",  2,   34,  2,    false, false, 0.01f, offsetof(Solax_LiveData_t, Grid_Frequency_Fault), 12 },
+    { "dci_fault",              "mA",  0,   36,  2,    false, false, 1.0f,  offsetof(Solax_LiveData_t, DCI_Fault),            13 },
+    { "temperature_fault",      "C",   0,   38,  2,    false, false, 1.0f,  offsetof(Solax_LiveData_t, Temperature_Fault),    14 },
+    { "pv1_voltage_fault",      "V",   1,   40,  2,    false, false, 0.1f,  offsetof(Solax_LiveData_t, PV1_Voltage_Fault),    15 },
+    { "pv2_voltage_fault",      "V",   1,   42,  2,    false, false, 0.1f,  offsetof(Solax_LiveData_t, PV2_Voltage_Fault),    16 },
+    { "gfc_fault",              "",    0,   44,  2,    false, false, 1.0f,  offsetof(Solax_LiveData_t, GFC_Fault),            17 },
+};
+
+
+double solax_Register_Value(const Solax_LiveData_t* liveData, const Solax_Register_t* reg)
+{
+    return reg->bits ? LIVE_DATA_BITS(liveData, reg->field) : LIVE_DATA_FLOAT(liveData, reg->field);
+}
+
+
+/* the register values are kept raw, Solax_LiveData_t is built from the sample ring */
+void solax_LiveData_Decode(Solax_RawData_t* rawData, const uint8_t data[])
+{
+    const Solax_Register_t* reg;
+    uint32_t value;
+    int i, b;
+    
+    for (i = 0; i < REGISTER_COUNT; i++)
+    {
+        reg = &solax_Registers[i];
+        value = 0;
+        for (b = 0; b < reg->width; b++)
+        {
+            value |= (uint32_t)data[reg->offset + b] << (8 * (reg->littleEndian ? b : reg->width - 1 - b));
+        }
+        rawData->raw[i] = value;
+        
+        DEBUG_MESSAGE("Solax: LiveData.%s: %.*f %s", reg->name, reg->precision, reg->bits ? (double)value : value * reg->scale, reg->unit);
+    }
+}
+
+
+Solax_ErrorQuery_t solax_ReceiveQuery(Solax_Inverter_t* inverter, Solax_RawData_t* rawData, bool timeout)
+{
+    Solax_Bus_t* bus = inverter->Bus;
+    Solax_Message_t* rxMessage = &bus->rxMessage;
+    Solax_Inverter_t* registered;
+    
+    int i;
+    Solax_ErrorQuery_t error;
+        
+    error = solax_RS485_Receive(bus, rxMessage, timeout);
+    if (error == -1) return -1;
+    if (error == ERR_INCOMPLETE) return error;
+    
+    *rawData = (Solax_RawData_t) {0};
+        
+    switch (inverter->StateQuery)
+    {
+        case STATE_BROARDCAST:
+        {
+            if (error == ERR_NO_DATA)
+            {
+                // Maybe the Solax-X1 inverter is offline (e.g. no sunlight);
+                DEBUG_MESSAGE("Solax: No broadcast response");
+            }
+            else if (error == ERR_CRC_ERROR)
+            {
+                DEBUG_MESSAGE("Solax: Broadcast response CRC error");
+            }
+            else if ((error == ERR_INVALID_MSG) || (rxMessage->ControlCode != 0x10) || (rxMessage->FunctionCode != 0x80))
+            {
+                DEBUG_MESSAGE("Solax: Invalid broadcast response message");
+            }
+            else
+            {
+                // Serial number from query response, a known inverter of this bus keeps its bus address
+                registered = inverter;
+                for (i = 0; i < bus->inverterCount; i++)
+                {
+                    if (memcmp(bus->inverters[i]->SerialNumber, rxMessage->Data, 14) == 0) registered = bus->inverters[i];
+                }
+                memcpy(registered->SerialNumber, rxMessage->Data, 14);
+                registered->SerialNumber[14] = '\0';
+                registered->StateQuery = STATE_INVERTER_ADDRESS;
+                registered->CountError = 0;
+                DEBUG_MESSAGE("Solax: Serial number: %s", registered->SerialNumber);
+                
+                if (registered != inverter) error = ERR_INVALID_MSG;    // the broadcast is continued by the querying inverter
+            }
+            break;
+        }
+        
+        case STATE_INVERTER_ADDRESS:
+        {
+            if (error == ERR_NO_DATA)
+            {
+                DEBUG_MESSAGE("Solax: No address confirmation response");
+            }
+            else if (error == ERR_CRC_ERROR)
+            {
+                DEBUG_MESSAGE("Solax: Address confirmation response CRC error");
+            }
+            else if ((error == ERR_INVALID_MSG) || (rxMessage->ControlCode != 0x10) || (rxMessage->FunctionCode != 0x81) || (rxMessage->Data[0] != 0x06))
+            {
+                DEBUG_MESSAGE("Solax: Invalid address confirmation message");
+            }
+            else
+            {
+                DEBUG_MESSAGE("Solax: Inverter Bus-Address 0x%02X confirmed", inverter->Address);
+            }
+            break;
+        }
+        
+        case STATE_QUERY_LIVE_DATA:
+        {
+            if (error == ERR_NO_DATA)
+            {
+                DEBUG_MESSAGE("Solax: No live data response");
+            }
+            else if (error == ERR_CRC_ERROR)
+            {
+                DEBUG_MESSAGE("Solax: Data response CRC error");
+            }
+            else if ((error == ERR_INVALID_MSG) || (rxMessage->ControlCode != 0x11) || (rxMessage->FunctionCode != 0x82) || (rxMessage->Source[1] != inverter->Address))
+            {
+                DEBUG_MESSAGE("Solax: Invalid live data message");
+            }
+            else
+            {
+                solax_LiveData_Decode(rawData, rxMessage->Data);
+                rawData->valid = true;
+            }
+            break;
+        }
+    }
+    return error;
+}
+
+
+/* --- State Machine Communication with Solax-X1_Mini --- */
+int solax_QueryHandle(Solax_Inverter_t* inverter, Solax_RawData_t* rawData, bool timeout)
+{
+    Solax_Bus_t* bus = inverter->Bus;
+    Solax_StateQuery_t stateQuery = inverter->StateQuery;
+    Solax_StateQuery_t statePrevious = stateQuery;
+    Solax_ErrorQuery_t errorRx;
+    double latency;
+        
+    errorRx = solax_ReceiveQuery(inverter, rawData, timeout);
+    if (errorRx == -1) return -1;
+    if (errorRx == ERR_INCOMPLETE) return errorRx;
+    
+    bus->queryPending = false;
+    timing_End(bus, errorRx);
+    
+    inverter->Counters.queries[stateQuery]++;
+    inverter->Counters.responses[errorRx]++;
+    if (errorRx == ERR_NONE)
+    {
+        latency = metrics_Now() - bus->queryTime;
+        metrics_Observe(&metrics_Data.queryLatency, latency);
+        bus->latencyAverage += (bus->latencyAverage > 0) ? (latency * 1000 - bus->latencyAverage) / 8 : latency * 1000;
+    }
+    
+    switch (stateQuery)
+    {
+        case STATE_BROARDCAST:
+        {
+            if (errorRx)
+            {
+                // inverter is gone, try the known address again after a growing delay
+                inverter->CountError = 0;
+                inverter->Backoff = (inverter->Backoff == 0) ? arg_QueryInterval : inverter->Backoff * 2;
+                if (inverter->Backoff > RECONNECT_BACKOFF_MAX) inverter->Backoff = RECONNECT_BACKOFF_MAX;
+                inverter->TimeRetry = timing_Now() / 1000000 + inverter->Backoff;
+                stateQuery = STATE_QUERY_LIVE_DATA;
+                DEBUG_MESSAGE("Solax: Inverter 0x%02X not found, next attempt in %d ms", inverter->Address, inverter->Backoff);
+            }
+            else
+            {
+                inverter->CountError = 0;
+                inverter->QueryAgain = true;
+                stateQuery = STATE_INVERTER_ADDRESS;
+            }
+            break;
+        }
+        
+        case STATE_INVERTER_ADDRESS:
+        {
+            inverter->CountError = 0;
+            inverter->QueryAgain = true;
+            stateQuery = errorRx ? STATE_BROARDCAST : STATE_QUERY_LIVE_DATA;
+            break;
+        }
+        
+        case STATE_QUERY_LIVE_DATA:
+        {
+            if (errorRx)
+            {
+                // retry at once, then register again with the known serial number, without broadcast
+                inverter->CountError++;
+                inverter->QueryAgain = true;
+                if (inverter->CountError >= RECONNECT_LIVE_ERRORS)
+                {
+                    inverter->CountError = 0;
+                    stateQuery = inverter->SerialNumber[0] ? STATE_INVERTER_ADDRESS : STATE_BROARDCAST;
+                }
+            }
+            else
+            {
+                inverter->CountError = 0;
+                inverter->Backoff = 0;
+                inverter->TimeValid = timing_Now() / 1000000;
+            }
+            break;
+        }
+    }
+    
+    if (inverter->Online == true)
+    {
+        if (timing_Now() / 1000000 - inverter->TimeValid >= TIMEOUT_INVERTER_ONLINE_MS)
+        {
+            inverter->Online = false;
+            NOTICE_MESSAGE("Solax: Inverter 0x%02X offline", inverter->Address);
+        }
+    }
+    else  // (inverter->Online == false)
+    {
+        if ((errorRx == ERR_NONE) && (statePrevious == STATE_QUERY_LIVE_DATA))
+        {
+            inverter->Online = true;
+            NOTICE_MESSAGE("Solax: Inverter 0x%02X live data received", inverter->Address);
+        }
+    }
+    
+    if (stateQuery != statePrevious) inverter->Counters.stateChanges[statePrevious][stateQuery]++;
+    inverter->StateQuery = stateQuery;
+    return errorRx;
+}
+
+
+/* --- Send query of current state, the response is handled by solax_QueryHandle() --- */
+int solax_QueryStart(Solax_Inverter_t* inverter)
+{
+    Solax_Bus_t* bus = inverter->Bus;
+    Solax_ErrorQuery_t errorTx;
+    
+    if (bus->transport->query(bus) == -1) return -1;
+    bus->queryTrace = (arg_TraceSample > 0) && (solax_TraceCount++ % arg_TraceSample == 0);
+    metrics_Data.rxDiscarded += bus->framer.discarded;
+    solax_Framer_Reset(&bus->framer);
+    timing_Begin(bus, inverter);
+    
+    errorTx = solax_SendQuery(inverter);
+    if (errorTx == -1) return -1;
+    
+    bus->queryTime = metrics_Now();
+    bus->queryInverter = inverter;
+    bus->queryPending = true;
+    return 0;
+}
+
+
+
+/* --- Sample ring: raw register values in one column per register, scaled when read --- */
+uint32_t solax_Sample_Raw(const Solax_Samples_t* samples, const Solax_Register_t* reg, uint32_t number)
+{
+    uint16_t index = number % SAMPLE_BUFFER_COUNT;
+    
+    return (reg->width == 2) ? samples->raw16[reg->column][index] : samples->raw32[reg->column][index];
+}
+
+
+int64_t solax_Sample_Time(const Solax_Samples_t* samples, uint32_t number)
+{
+    return samples->timeBase + samples->time[number % SAMPLE_BUFFER_COUNT];
+}
+
+
+void solax_Sample_Store(Solax_Samples_t* samples, uint32_t number, const Solax_RawData_t* sample, int64_t time)
+{
+    uint16_t index = number % SAMPLE_BUFFER_COUNT;
+    const Solax_Register_t* reg;
+    int64_t shift;
+    int i;
+    
+    // the times stay in 32 bits, a time older than the shift is clamped to the base
+    if (number == 0) samples->timeBase = time;
+    if (time - samples->timeBase >= SAMPLE_TIME_REBASE)
+    {
+        shift = time - samples->timeBase - SAMPLE_TIME_REBASE / 2;
+        for (i = 0; i < SAMPLE_BUFFER_COUNT; i++) samples->time[i] = (samples->time[i] > shift) ? samples->time[i] - shift : 0;
+        samples->timeBase += shift;
+    }
+    
+    // invalid samples are 0 and add nothing to the column sums
+    for (i = 0; i < REGISTER_COUNT; i++)
+    {
+        reg = &solax_Registers[i];
+        if (reg->width == 2) samples->raw16[reg->column][index] = sample->raw[i];
+        else samples->raw32[reg->column][index] = sample->raw[i];
+    }
+    samples->valid[index] = sample->valid;
+    samples->time[index] = time - samples->timeBase;
+}
+
+
+void solax_Sample_Load(const Solax_Samples_t* samples, uint32_t number, Solax_LiveData_t* sample)
+{
+    const Solax_Register_t* reg;
+    uint32_t raw;
+    int i;
+    
+    *sample = (Solax_LiveData_t) { .valid = samples->valid[number % SAMPLE_BUFFER_COUNT] };
+    for (i = 0; i < REGISTER_COUNT; i++)
+    {
+        reg = &solax_Registers[i];
+        raw = solax_Sample_Raw(samples, reg, number);
+        if (reg->bits) LIVE_DATA_BITS(sample, reg->field) = raw;
+        else LIVE_DATA_FLOAT(sample, reg->field) = raw * reg->scale;
+    }
+}
+
+
+/* sum of the raw values of the samples from .. to - 1, the column is read in at most two contiguous parts */
+int64_t solax_Sample_Sum(const Solax_Samples_t* samples, const Solax_Register_t* reg, uint32_t from, uint32_t to)
+{
+    uint32_t begin = from % SAMPLE_BUFFER_COUNT;
+    uint32_t count = to - from;
+    uint32_t part, j;
+    int64_t sum = 0;
+    
+    while (count)
+    {
+        part = (count < SAMPLE_BUFFER_COUNT - begin) ? count : SAMPLE_BUFFER_COUNT - begin;
+        if (reg->width == 2)
+        {
+            const uint16_t* column = &samples->raw16[reg->column][begin];
+            for (j = 0; j < part; j++) sum += column[j];
+        }
+        else
+        {
+            const uint32_t* column = &samples->raw32[reg->column][begin];
+            for (j = 0; j < part; j++) sum += column[j];
+        }
+        count -= part;
+        begin = 0;
+    }
+    return sum;
+}
+
+
+/* --- Sliding window, each sample updates the averages in constant time --- */
+static const Solax_Register_t* const solax_AverageFields[AVERAGE_FIELD_COUNT] =
+{
+    &solax_Registers[0],    // temperature
+    &solax_Registers[1],    // dc1_voltage
+    &solax_Registers[2],    // dc1_current
+    &solax_Registers[3],    // dc2_voltage
+    &solax_Registers[4],    // dc2_current
+    &solax_Registers[5],    // ac_voltage
+    &solax_Registers[6],    // ac_current
+    &solax_Registers[7],    // frequency
+    &solax_Registers[8],    // power
+};
+
+static const Solax_Register_t* const solax_MaximumFields[MAXIMUM_FIELD_COUNT] =
+{
+    &solax_Registers[9],    // energy_today
+    &solax_Registers[10],   // energy_total
+    &solax_Registers[11],   // runtime_total
+    &solax_Registers[12],   // status
+    &solax_Registers[14],   // grid_voltage_fault
+    &solax_Registers[15],   // grid_frequency_fault
+    &solax_Registers[16],   // dci_fault
+    &solax_Registers[17],   // temperature_fault
+    &solax_Registers[18],   // pv1_voltage_fault
+    &solax_Registers[19],   // pv2_voltage_fault
+    &solax_Registers[20],   // gfc_fault
+};
+
+static const Solax_Register_t* const solax_ErrorBitsField = &solax_Registers[13];
+
+/* the number of the sample or its ring index */
+uint32_t solax_Window_MaxValue(const Solax_Inverter_t* inverter, int field, uint32_t number)
+{
+    return solax_Sample_Raw(&inverter->Samples, solax_MaximumFields[field], number);
+}
+
+
+/* maximum of the window is the head of the deque */
+float solax_Window_Max(const Solax_Inverter_t* inverter, int field)
+{
+    const Solax_MaxDeque_t* deque = &inverter->Window.max[field];
+    return solax_Window_MaxValue(inverter, field, deque->sample[deque->head]) * solax_MaximumFields[field]->scale;
+}
+
+
+void solax_Window_Remove(Solax_Inverter_t* inverter, uint32_t number)
+{
+    Solax_Window_t* window = &inverter->Window;
+    uint32_t errorBits = solax_Sample_Raw(&inverter->Samples, solax_ErrorBitsField, number);
+    int i;
+    
+    if (inverter->Samples.valid[number % SAMPLE_BUFFER_COUNT] != true) return;
+    
+    for (i = 0; i < AVERAGE_FIELD_COUNT; i++)
+    {
+        window->sum[i] -= solax_Sample_Raw(&inverter->Samples, solax_AverageFields[i], number);
+    }
+    for (i = 0; i < 32; i++)
+    {
+        if (errorBits & (1UL << i)) window->countErrorBit[i]--;
+    }
+    for (i = 0; i < MAXIMUM_FIELD_COUNT; i++)
+    {
+        Solax_MaxDeque_t* deque = &window->max[i];
+        if ((deque->count) && (deque->sample[deque->head] == number % SAMPLE_BUFFER_COUNT))
+        {
+            deque->head = (deque->head + 1) % SAMPLE_BUFFER_COUNT;
+            deque->count--;
+        }
+    }
+    
+    window->countValid--;
+}
+
+
+/* error bits and maxima of a new sample, the sums are updated by the caller */
+void solax_Window_Track(Solax_Inverter_t* inverter, uint32_t number)
+{
+    Solax_Window_t* window = &inverter->Window;
+    uint32_t errorBits = solax_Sample_Raw(&inverter->Samples, solax_ErrorBitsField, number);
+    uint32_t value;
+    int i;
+    uint16_t back;
+    
+    if (inverter->Samples.valid[number % SAMPLE_BUFFER_COUNT] != true) return;
+    
+    for (i = 0; i < 32; i++)
+    {
+        if (errorBits & (1UL << i)) window->countErrorBit[i]++;
+    }
+    for (i = 0; i < MAXIMUM_FIELD_COUNT; i++)
+    {
+        // drop all samples not greater than the new one, they can't be the maximum anymore
+        Solax_MaxDeque_t* deque = &window->max[i];
+        value = solax_Window_MaxValue(inverter, i, number);
+        while (deque->count)
+        {
+            back = (deque->head + deque->count - 1) % SAMPLE_BUFFER_COUNT;
+            if (solax_Window_MaxValue(inverter, i, deque->sample[back]) > value) break;
+            deque->count--;
+        }
+        deque->sample[(deque->head + deque->count) % SAMPLE_BUFFER_COUNT] = number % SAMPLE_BUFFER_COUNT;
+        deque->count++;
+    }
+    
+    window->countValid++;
+}
+
+
+void solax_Window_Add(Solax_Inverter_t* inverter, uint32_t number)
+{
+    Solax_Window_t* window = &inverter->Window;
+    int i;
+    
+    // an invalid sample has raw values of 0
+    for (i = 0; i < AVERAGE_FIELD_COUNT; i++)
+    {
+        window->sum[i] += solax_Sample_Raw(&inverter->Samples, solax_AverageFields[i], number);
+    }
+    solax_Window_Track(inverter, number);
+}
+
+
+void solax_Window_Average(Solax_Inverter_t* inverter)
+{
+    Solax_Window_t* window = &inverter->Window;
+    Solax_LiveData_t* average = &inverter->LiveData;
+    int i;
+    
+    *average = (Solax_LiveData_t) {0};
+    
+    if (window->countValid)
+    {
+        for (i = 0; i < AVERAGE_FIELD_COUNT; i++)
+        {
+            LIVE_DATA_FLOAT(average, solax_AverageFields[i]->field) = (double)window->sum[i] * solax_AverageFields[i]->scale / window->countValid;
+        }
+        for (i = 0; i < 32; i++)
+        {
+            if (window->countErrorBit[i]) average->ErrorBits |= (1UL << i);
+        }
+        for (i = 0; i < MAXIMUM_FIELD_COUNT; i++)
+        {
+            LIVE_DATA_FLOAT(average, solax_MaximumFields[i]->field) = solax_Window_Max(inverter, i);
+        }
+    }
+}
+
+
+/* --- New average interval: the window is filled again from the sample buffer --- */
+void solax_Window_Resize(Solax_Inverter_t* inverter, int64_t length)
+{
+    Solax_Window_t* window = &inverter->Window;
+    uint32_t number = inverter->SampleCount;
+    uint32_t oldest = (number > SAMPLE_BUFFER_COUNT) ? number - SAMPLE_BUFFER_COUNT : 0;
+    int64_t now = timing_Now() / 1000000;
+    int64_t tolerance = inverter->Bus->roundPeriod / 2;
+    int i;
+    
+    memset(window->countErrorBit, 0, sizeof(window->countErrorBit));
+    for (i = 0; i < MAXIMUM_FIELD_COUNT; i++) window->max[i].count = 0;
+    window->countValid = 0;
+    window->length = length;
+    
+    // the same samples solax_LiveData_Average() keeps in a window of this length
+    while ((oldest < number) && (now - solax_Sample_Time(&inverter->Samples, oldest) > length - tolerance)) oldest++;
+    window->oldest = oldest;
+    for (i = 0; i < AVERAGE_FIELD_COUNT; i++) window->sum[i] = solax_Sample_Sum(&inverter->Samples, solax_AverageFields[i], oldest, number);
+    for (; oldest < number; oldest++) solax_Window_Track(inverter, oldest);
+    
+    solax_Window_Average(inverter);
+}
+
+
+void solax_LiveData_Average(Solax_Inverter_t* inverter, const Solax_RawData_t* sample)
+{
+    Solax_Window_t* window = &inverter->Window;
+    Solax_Samples_t* samples = &inverter->Samples;
+    uint32_t number = inverter->SampleCount;
+    int64_t now = timing_Now() / 1000000;
+    int64_t tolerance = inverter->Bus->roundPeriod / 2;    // jitter of the query schedule
+    
+    // the overwritten sample leaves the window and the QoS interval
+    if (number - window->oldest >= SAMPLE_BUFFER_COUNT) solax_Window_Remove(inverter, window->oldest++);
+    if (number - window->oldestQoS >= SAMPLE_BUFFER_COUNT) window->countQoS -= samples->valid[window->oldestQoS++ % SAMPLE_BUFFER_COUNT];
+    
+    solax_Sample_Store(samples, number, sample, now);
+    solax_Window_Add(inverter, number);
+    window->countQoS += sample->valid;
+    inverter->SampleCount++;
+    
+    // samples older than the average window and the QoS interval leave them
+    while ((window->oldest < number) && (now - solax_Sample_Time(samples, window->oldest) > window->length - tolerance))
+    {
+        solax_Window_Remove(inverter, window->oldest++);
+    }
+    while ((window->oldestQoS < number) && (now - solax_Sample_Time(samples, window->oldestQoS) > QUALITY_OF_SERVICE_INTERVAL_MS - tolerance))
+    {
+        window->countQoS -= samples->valid[window->oldestQoS++ % SAMPLE_BUFFER_COUNT];
+    }
+    
+    solax_Window_Average(inverter);
+    
+    inverter->QualityOfService = (float)window->countQoS / (inverter->SampleCount - window->oldestQoS);
+    
+    /*
+    INFO_MESSAGE("TEST: LiveData.QualityOfService: %.2f", inverter->QualityOfService);
+    INFO_MESSAGE("TEST: LiveData.Temperature: %.0f C",    average->Temperature);
+    INFO_MESSAGE("TEST: LiveData.Power: %.0f W",          average->Power);
+    INFO_MESSAGE("TEST: LiveData.Energy_Total: %.1f kWh", average->Energy_Total);
+    INFO_MESSAGE("TEST: LiveData.ErrorBits: 0x%08X",      average->ErrorBits);
+    INFO_MESSAGE("TEST: Counter: %d", window->countValid);
+    */
+}
+
+
+int solax_JsonPath_Inverter(char buffer[], const Solax_Snapshot_Inverter_t* inverter, const char indent[])
+{
+    const Solax_LiveData_t* liveData = &inverter->LiveData;
+    int i;
+    
+    static const char* solax_ErrorText[32] =
+    {
+        "Tz Protection Fault",           // Byte 0.0
+        "Mains Lost Fault",              // Byte 0.1
+        "Grid Voltage Fault",            // Byte 0.2
+        "Grid Frequency Fault",          // Byte 0.3
+        "PLL Lost Fault",                // Byte 0.4
+        "Bus Voltage Fault",             // Byte 0.5
+        "Error Bit 06",                  // Byte 0.6
+        "Oscillator Fault",              // Byte 0.7
+        
+        "DCI OCP Fault",                 // Byte 1.0
+        "Residual Current Fault",        // Byte 1.1
+        "PV Voltage Fault",              // Byte 1.2
+        "Ac10Mins Voltage Fault",        // Byte 1.3
+        "Isolation Fault",               // Byte 1.4
+        "Over Temperature Fault",        // Byte 1.5
+        "Ventilator Fault",              // Byte 1.6
+        "Error Bit 15",                  // Byte 1.7
+        
+        "SPI Communication Fault",       // Byte 2.0
+        "SCI Communication Fault",       // Byte 2.1
+        "Error Bit 18",                  // Byte 2.2
+        "Input Configuration Fault",     // Byte 2.3
+        "EEPROM Fault",                  // Byte 2.4
+        "Relay Fault",                   // Byte 2.5
+        "Sample Consistence Fault",      // Byte 2.6
+        "Residual-Current Device Fault", // Byte 2.7
+        
+        "Error Bit 24",                  // Byte 3.0
+        "Error Bit 25",                  // Byte 3.1
+        "Error Bit 26",                  // Byte 3.2
+        "Error Bit 27",                  // Byte 3.3
+        "Error Bit 28",                  // Byte 3.4
+        "DCI Device Fault",              // Byte 3.5
+        "Other Device Fault",            // Byte 3.6
+        "Error Bit 31",                  // Byte 3.7
+    };
+    
+    int len = 0;
+    len += sprintf(&buffer[len], "%s{\r\n",                                   indent);
+    len += sprintf(&buffer[len], "%s  \"address\": %d,\r\n",                  indent, inverter->Address);
+    len += sprintf(&buffer[len], "%s  \"online\": %d,\r\n",                   indent, inverter->Online);
+    len += sprintf(&buffer[len], "%s  \"quality_of_service\": %.2f,\r\n",     indent, inverter->QualityOfService);
+    len += sprintf(&buffer[len], "%s  \"live_data\":\r\n",                    indent);
+    len += sprintf(&buffer[len], "%s  {\r\n",                                 indent);
+    for (i = 0; i < REGISTER_COUNT; i++)
+    {
+        len += sprintf(&buffer[len], "%s    \"%s\": %.*f%s\r\n", indent, solax_Registers[i].name, solax_Registers[i].precision,
+                       solax_Register_Value(liveData, &solax_Registers[i]), (i < REGISTER_COUNT - 1) ? "," : "");
+    }
+    len += sprintf(&buffer[len], "%s  }\r\n",                                 indent);
+    len += sprintf(&buffer[len], "%s}",                                       indent);
+    
+    return len;
+}
+
+
+int solax_JsonPath(char buffer[], const Solax_Snapshot_t* snapshot)
+{
+    int i;
+    int len = 0;
+    
+    len += sprintf(&buffer[len], "{\r\n");
+    len += sprintf(&buffer[len], "  \"inverter\":\r\n");
+    if (snapshot->inverterCount == 1)
+    {
+        len += solax_JsonPath_Inverter(&buffer[len], &snapshot->inverters[0], "  ");
+        len += sprintf(&buffer[len], "\r\n");
+    }
+    else
+    {
+        // more inverters in the bus are listed as array
+        len += sprintf(&buffer[len], "  [\r\n");
+        for (i = 0; i < snapshot->inverterCount; i++)
+        {
+            len += solax_JsonPath_Inverter(&buffer[len], &snapshot->inverters[i], "    ");
+            len += sprintf(&buffer[len], (i < snapshot->inverterCount - 1) ? ",\r\n" : "\r\n");
+        }
+        len += sprintf(&buffer[len], "  ]\r\n");
+    }
+    len += sprintf(&buffer[len], "}\r\n");
+    
+    return len;
+}
+
+
+
+/* --- A response body is rendered again while connections are still sending it, copy their remainder --- */
+void http_Response_Detach(const Http_Response_t* response)
+{
+    int i, sent, header;
+    Http_Connection_t* conn;
+    
+    for (i = 0; i < MAX_HTTP_CLIENTS; i++)
+    {
+        conn = &http_Worker->connections[i];
+        if ((conn->handler.fd < 0) || (conn->body != response->data)) continue;
+        
+        // only slow clients get here, the header fits always in front of the body
+        sent = conn->txOffset - conn->txLength;
+        header = 0;
+        if (sent < 0)
+        {
+            header = -sent;
+            memmove(conn->txBuffer, &conn->txBuffer[conn->txOffset], header);
+            sent = 0;
+        }
+        memcpy(&conn->txBuffer[header], &conn->body[sent], conn->bodyLength - sent);
+        conn->txLength = header + conn->bodyLength - sent;
+        conn->txOffset = 0;
+        conn->body = NULL;
+        conn->bodyLength = 0;
+        DEBUG_MESSAGE("HTTP: Response copied for slow connection %d", conn->handler.fd);
+    }
+}
+
+
+/* --- The ETag stays the same while the body is unchanged, e.g. at night while the inverters are offline --- */
+void http_Response_Tag(Http_Response_t* response, uint32_t generation)
+{
+    uint64_t hash = 14695981039346656037ULL;    // FNV-1a
+    int i;
+    
+    for (i = 0; i < response->length; i++)
+    {
+        hash = (hash ^ (uint8_t)response->data[i]) * 1099511628211ULL;
+    }
+    if (hash != response->hash) response->etag = generation;
+    response->hash = hash;
+}
+
+
+/* --- Render the response body once per sample, instead of once per request --- */
+void http_Response_Build(Http_Response_t* response, const Solax_Snapshot_t* snapshot)
+{
+    int len = 0;
+    
+    http_Response_Detach(response);
+    len += solax_JsonPath(&response->data[len], snapshot);
+    
+    response->length = len;
+    response->generation = snapshot->generation;
+    http_Response_Tag(response, snapshot->generation);
+}
+
+
+/* --- /live.bin: fixed little-endian layout of the averaged live data in register units --- */
+// the registers of 2 bytes first, then the registers of 4 bytes, each in the order of solax_Registers[]
+int8_t http_Binary_Scale(const Solax_Register_t* reg)
+{
+    float factor = reg->scale;
+    int8_t scale = 0;
+    
+    while (factor < 0.5f)
+    {
+        factor *= 10.0f;
+        scale--;
+    }
+    return scale;
+}
+
+
+int http_Binary_Put(char buffer[], uint32_t value, int size)
+{
+    int i;
+    
+    for (i = 0; i < size; i++)
+    {
+        buffer[i] = (char)(value >> (8 * i));
+    }
+    return size;
+}
+
+
+uint32_t http_Binary_Register(float value, int8_t scale)
+{
+    static const float factor[] = { 1.0f, 10.0f, 100.0f, 1000.0f, 10000.0f };
+    
+    value = value * factor[-scale] + 0.5f;
+    return (value > 0) ? (uint32_t)value : 0;
+}
+
+
+int http_Binary_Field(char buffer[], const Solax_LiveData_t* liveData, const Solax_Register_t* reg)
+{
+    uint32_t value;
+    
+    if (reg->bits) value = LIVE_DATA_BITS(liveData, reg->field);
+    else value = http_Binary_Register(LIVE_DATA_FLOAT(liveData, reg->field), http_Binary_Scale(reg));
+    return http_Binary_Put(buffer, value, reg->width);
+}
+
+
+void http_Response_BuildBinary(Http_Response_t* response, const Solax_Snapshot_t* snapshot)
+{
+    const Solax_Snapshot_Inverter_t* inverter;
+    const Solax_LiveData_t* liveData;
+    struct timespec timeNow;
+    char* data = response->data;
+    int len = 0;
+    int i, width, field;
+    
+    http_Response_Detach(response);
+    clock_gettime(CLOCK_REALTIME, &timeNow);
+    
+    // header, 44 bytes
+    memcpy(&data[len], "SXLB", 4);                                len += 4;
+    len += http_Binary_Put(&data[len], BINARY_VERSION, 1);
+    len += http_Binary_Put(&data[len], snapshot->inverterCount, 1);
+    len += http_Binary_Put(&data[len], REGISTER_COUNT, 1);
+    len += http_Binary_Put(&data[len], BINARY_RECORD_SIZE, 1);
+    len += http_Binary_Put(&data[len], snapshot->generation, 4);
+    len += http_Binary_Put(&data[len], (uint32_t)timeNow.tv_sec, 4);
+    len += http_Binary_Put(&data[len], (uint32_t)(timeNow.tv_nsec / 1000000), 4);
+    data[len++] = -4;                                               // scale of quality_of_service
+    for (width = 2; width <= 4; width += 2)
+    {
+        for (field = 0; field < REGISTER_COUNT; field++)
+        {
+            if (solax_Registers[field].width == width) data[len++] = http_Binary_Scale(&solax_Registers[field]);
+        }
+    }
+    len += http_Binary_Put(&data[len], 0, 2);
+    
+    // one record of BINARY_RECORD_SIZE bytes per inverter
+    for (i = 0; i < snapshot->inverterCount; i++)
+    {
+        inverter = &snapshot->inverters[i];
+        liveData = &inverter->LiveData;
+        
+        len += http_Binary_Put(&data[len], inverter->Address, 1);
+        len += http_Binary_Put(&data[len], (inverter->Online ? 0x01 : 0) | (inverter->Valid ? 0x02 : 0), 1);
+        len += http_Binary_Put(&data[len], 0, 2);
+        len += http_Binary_Put(&data[len], http_Binary_Register(inverter->QualityOfService, -4), 2);
+        len += http_Binary_Put(&data[len], 0, 2);
+        for (width = 2; width <= 4; width += 2)
+        {
+            for (field = 0; field < REGISTER_COUNT; field++)
+            {
+                if (solax_Registers[field].width == width) len += http_Binary_Field(&data[len], liveData, &solax_Registers[field]);
+            }
+        }
+    }
+    
+    response->length = len;
+    response->generation = snapshot->generation;
+    http_Response_Tag(response, snapshot->generation);
+}
+
+
+int solax_JsonLiveData(char buffer[], const Solax_LiveData_t* liveData)
+{
+    int len = 0;
+    
+    int i;
+    
+    len += sprintf(&buffer[len], "{\"valid\":%d", liveData->valid);
+    for (i = 0; i < REGISTER_COUNT; i++)
+    {
+        len += sprintf(&buffer[len], ",\"%s\":%.*f", solax_Registers[i].name, solax_Registers[i].precision, solax_Register_Value(liveData, &solax_Registers[i]));
+    }
+    len += sprintf(&buffer[len], "}");
+    
+    return len;
+}
+
+
+int solax_JsonCompact(char buffer[], const Solax_Snapshot_Inverter_t* inverter, const Solax_LiveData_t* liveData)
+{
+    int len = 0;
+    
+    len += sprintf(&buffer[len], "{\"address\":%d,\"online\":%d,\"quality_of_service\":%.2f,\"live_data\":", inverter->Address, inverter->Online, inverter->QualityOfService);
+    len += solax_JsonLiveData(&buffer[len], liveData);
+    len += sprintf(&buffer[len], "}");
+    
+    return len;
+}
+
+
+time_t http_Time(void)
+{
+    struct timespec timeNow;
+    
+    clock_gettime(CLOCK_MONOTONIC, &timeNow);
+    return timeNow.tv_sec;
+}
+
+
+/* --- Fields of an inverter, used by MQTT and /metrics: online, quality_of_service and the registers --- */
+const char* solax_FieldName(int field, char buffer[], int size)
+{
+    if (field == 0) return "online";
+    if (field == 1) return "quality_of_service";
+    snprintf(buffer, size, "live_data/%s", solax_Registers[field - 2].name);
+    return buffer;
+}
+
+
+int solax_FieldPrecision(int field)
+{
+    if (field == 0) return 0;
+    if (field == 1) return 2;
+    return solax_Registers[field - 2].precision;
+}
+
+
+double solax_FieldValue(const Solax_Snapshot_Inverter_t* inverter, int field)
+{
+    if (field == 0) return inverter->Online;
+    if (field == 1) return inverter->QualityOfService;
+    return solax_Register_Value(&inverter->LiveData, &solax_Registers[field - 2]);
+}
+
+
+/* --- Sample history: ring of fixed-size records in a memory-mapped file --- */
+int history_Open(History_t* history, const char path[])
+{
+    History_Header_t header = {0};
+    struct stat st;
+    uint64_t capacity = HISTORY_RECORD_COUNT;
+    bool valid;
+    
+    history->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (history->fd == -1) { ERROR_MESSAGE("Init: Error opening history file '%s': %s", path, strerror(errno)); return -1; }
+    
+    // an existing history is continued with its own capacity
+    valid = (fstat(history->fd, &st) == 0) && (pread(history->fd, &header, sizeof(header), 0) == sizeof(header)) &&
+            (memcmp(header.magic, "SOLAXHIS", 8) == 0) && (header.version == HISTORY_VERSION) &&
+            (header.recordSize == sizeof(History_Record_t)) && (header.capacity > 0) &&
+            ((uint64_t)st.st_size == HISTORY_HEADER_SIZE + header.capacity * sizeof(History_Record_t));
+    if (valid) capacity = header.capacity;
+    
+    history->mapLength = HISTORY_HEADER_SIZE + capacity * sizeof(History_Record_t);
+    if (!valid)
+    {
+        NOTICE_MESSAGE("Init: Creating history file '%s' for %llu records", path, (unsigned long long)capacity);
+        if ((ftruncate(history->fd, 0) == -1) || (ftruncate(history->fd, history->mapLength) == -1))
+        {
+            ERROR_MESSAGE("Init: Error creating history file '%s': %s", path, strerror(errno));
+            return -1;
+        }
+    }
+    
+    history->header = mmap(NULL, history->mapLength, PROT_READ | PROT_WRITE, MAP_SHARED, history->fd, 0);
+    if (history->header == MAP_FAILED) { ERROR_MESSAGE("Init: Error mapping history file '%s': %s", path, strerror(errno)); return -1; }
+    history->records = (History_Record_t*)((uint8_t*)history->header + HISTORY_HEADER_SIZE);
+    
+    if (!valid)
+    {
+        memcpy(history->header->magic, "SOLAXHIS", 8);
+        history->header->version = HISTORY_VERSION;
+        history->header->recordSize = sizeof(History_Record_t);
+        history->header->capacity = capacity;
+        history->header->written = 0;
+    }
+    history->synced = history->header->written;
+    history->lastSync = http_Time();
+    
+    NOTICE_MESSAGE("Init: History file '%s' opened successfully, %llu of %llu records used", path,
+                   (unsigned long long)((history->header->written < capacity) ? history->header->written : capacity), (unsigned long long)capacity);
+    return 0;
+}
+
+
+uint64_t history_First(const History_t* history)
+{
+    uint64_t written = __atomic_load_n(&history->header->written, __ATOMIC_ACQUIRE);
+    
+    return (written > history->header->capacity) ? written - history->header->capacity : 0;
+}
+
+
+/* returns false if the record has been overwritten, before or while it was copied */
+bool history_Read(const History_t* history, uint64_t number, History_Record_t* copy)
+{
+    const History_Record_t* record = &history->records[number % history->header->capacity];
+    uint32_t sequence;
+    
+    do
+    {
+        while ((sequence = __atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE)) & 1);
+        memcpy(copy, record, sizeof(*copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&record->sequence, __ATOMIC_RELAXED) != sequence);
+    
+    return number >= history_First(history);
+}
+
+
+void history_Append(History_t* history, const Solax_Inverter_t* inverter, const Solax_LiveData_t* sample)
+{
+    History_Record_t* record;
+    struct timespec timeNow;
+    uint64_t written;
+    int64_t time, last;
+    
+    if (history->header == NULL) return;
+    
+    // the records stay in time order for history_Find(), a step of the clock back is clamped to the last record
+    clock_gettime(CLOCK_REALTIME, &timeNow);
+    time = (int64_t)timeNow.tv_sec * 1000 + timeNow.tv_nsec / 1000000;
+    written = history->header->written;
+    last = (written > 0) ? history->records[(written - 1) % history->header->capacity].Time : INT64_MIN;
+    if ((time < last) && !history->clockBack) NOTICE_MESSAGE("History: Clock %lld ms behind the last record, times are clamped", (long long)(last - time));
+    history->clockBack = (time < last);
+    if (time < last) time = last;
+    
+    record = &history->records[written % history->header->capacity];
+    
+    // seqlock, the oldest record may be copied by an HTTP thread
+    __atomic_store_n(&record->sequence, record->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    record->Time = time;
+    record->Address = inverter->Address;
+    record->LiveData = *sample;
+    __atomic_store_n(&record->sequence, record->sequence + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&history->header->written, written + 1, __ATOMIC_RELEASE);    // record complete for the HTTP threads
+}
+
+
+/* returns number of the first record at or after time (in milliseconds), records are in time order */
+uint64_t history_Find(const History_t* history, int64_t time)
+{
+    uint64_t low = history_First(history);
+    uint64_t high = __atomic_load_n(&history->header->written, __ATOMIC_ACQUIRE);
+    uint64_t mid;
+    History_Record_t record;
+    
+    // an overwritten record counts as older than time
+    while (low < high)
+    {
+        mid = low + (high - low) / 2;
+        if (!history_Read(history, mid, &record) || (record.Time < time)) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+
+void history_SyncRange(History_t* history, uint64_t begin, uint64_t end)
+{
+    if (begin == end) return;
+    sync_file_range(history->fd, HISTORY_HEADER_SIZE + begin * sizeof(History_Record_t), (end - begin) * sizeof(History_Record_t), SYNC_FILE_RANGE_WRITE);
+}
+
+
+/* --- Start write back of the records appended since the last sync, without waiting for the card --- */
+void history_Sync(History_t* history)
+{
+    uint64_t capacity = history->header->capacity;
+    uint64_t first = history->synced;
+    uint64_t last = history->header->written;
+    uint64_t begin, end;
+    
+    if (first == last) return;
+    if (last - first > capacity) first = last - capacity;
+    
+    begin = first % capacity;
+    end = (last - 1) % capacity + 1;
+    if (begin < end)
+    {
+        history_SyncRange(history, begin, end);
+    }
+    else
+    {
+        history_SyncRange(history, begin, capacity);
+        history_SyncRange(history, 0, end);
+    }
+    sync_file_range(history->fd, 0, HISTORY_HEADER_SIZE, SYNC_FILE_RANGE_WRITE);
+    
+    TRACE_MESSAGE("History: %llu records written back", (unsigned long long)(last - first));
+    history->synced = last;
+}
+
+
+/* --- Called once per query interval --- */
+void history_Timer(History_t* history)
+{
+    time_t now = http_Time();
+    
+    if (history->header == NULL) return;
+    if (now - history->lastSync < arg_HistorySync) return;
+    
+    history->lastSync = now;
+    history_Sync(history);
+}
+
+
+/* --- Rollups: minimum, maximum, mean and last value of the fields per minute, hour and day in fixed rings --- */
+static const Rollup_Tier_t rollup_Tiers[ROLLUP_TIER_COUNT] =
+{
+    { "minute", 60,    ROLLUP_MINUTE_COUNT, 0                                       },
+    { "hour",   3600,  ROLLUP_HOUR_COUNT,   ROLLUP_MINUTE_COUNT                     },
+    { "day",    86400, ROLLUP_DAY_COUNT,    ROLLUP_MINUTE_COUNT + ROLLUP_HOUR_COUNT },
+};
+
+void rollup_Bucket_Add(Rollup_Bucket_t* bucket, const Solax_LiveData_t* sample, double energy)
+{
+    const Solax_Register_t* reg;
+    float value;
+    int i;
+    
+    for (i = 0; i < REGISTER_COUNT; i++)
+    {
+        reg = &solax_Registers[i];
+        if (reg->bits)
+        {
+            LIVE_DATA_BITS(&bucket->min, reg->field) &= LIVE_DATA_BITS(sample, reg->field);
+            LIVE_DATA_BITS(&bucket->max, reg->field) |= LIVE_DATA_BITS(sample, reg->field);
+            continue;
+        }
+        value = LIVE_DATA_FLOAT(sample, reg->field);
+        bucket->sum[i] += value;
+        if (value < LIVE_DATA_FLOAT(&bucket->min, reg->field)) LIVE_DATA_FLOAT(&bucket->min, reg->field) = value;
+        if (value > LIVE_DATA_FLOAT(&bucket->max, reg->field)) LIVE_DATA_FLOAT(&bucket->max, reg->field) = value;
+    }
+    bucket->last = *sample;
+    bucket->energy += energy;
+    bucket->count++;
+}
+
+
+/* constant time per sample: only the current bucket of each tier is touched, a bucket of the last pass of the ring is started again */
+void rollup_Add(Rollup_t* rollup, const Solax_LiveData_t* sample)
+{
+    const Rollup_Tier_t* tier;
+    Rollup_Bucket_t* bucket;
+    struct timespec timeNow;
+    struct tm infoTime;
+    int64_t local, number;
+    double energy = 0;
+    int t;
+    
+    clock_gettime(CLOCK_REALTIME, &timeNow);
+    localtime_r(&timeNow.tv_sec, &infoTime);
+    local = timeNow.tv_sec + infoTime.tm_gmtoff;    // buckets begin at local midnight
+    
+    // a decrease of the counter (reset, other inverter at the address) is not counted
+    if ((rollup->energyValid) && (sample->Energy_Total > rollup->energyTotal)) energy = sample->Energy_Total - rollup->energyTotal;
+    rollup->energyTotal = sample->Energy_Total;
+    rollup->energyValid = true;
+    
+    for (t = 0; t < ROLLUP_TIER_COUNT; t++)
+    {
+        tier = &rollup_Tiers[t];
+        number = local / tier->duration;
+        bucket = &rollup->buckets[tier->first + number % tier->count];
+        
+        // seqlock, the sequence is odd while the bucket is written
+        __atomic_store_n(&bucket->sequence, bucket->sequence + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        
+        if (bucket->number != number)
+        {
+            *bucket = (Rollup_Bucket_t) { .sequence = bucket->sequence, .number = number, .min = *sample, .max = *sample };
+            bucket->start = number * tier->duration - infoTime.tm_gmtoff;
+        }
+        rollup_Bucket_Add(bucket, sample, energy);
+        
+        __atomic_store_n(&bucket->sequence, bucket->sequence + 1, __ATOMIC_RELEASE);
+    }
+}
+
+
+/* returns false if the bucket holds no samples of this bucket number */
+bool rollup_Read(const Rollup_t* rollup, const Rollup_Tier_t* tier, int64_t number, Rollup_Bucket_t* copy)
+{
+    const Rollup_Bucket_t* bucket = &rollup->buckets[tier->first + number % tier->count];
+    uint32_t sequence;
+    
+    do
+    {
+        while ((sequence = __atomic_load_n(&bucket->sequence, __ATOMIC_ACQUIRE)) & 1);
+        memcpy(copy, bucket, sizeof(*copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&bucket->sequence, __ATOMIC_RELAXED) != sequence);
+    
+    return (copy->number == number) && (copy->count > 0);
+}
+
+
+void rollup_Mean(const Rollup_Bucket_t* bucket, Solax_LiveData_t* mean)
+{
+    int i;
+    
+    *mean = bucket->max;    // error_bits set in any sample
+    for (i = 0; i < REGISTER_COUNT; i++)
+    {
+        if (!solax_Registers[i].bits) LIVE_DATA_FLOAT(mean, solax_Registers[i].field) = bucket->sum[i] / bucket->count;
+    }
+}
+
+
+void http_Connection_Close(Http_Connection_t* conn)
+{
+    DEBUG_MESSAGE("HTTP: Connection %d closed", conn->handler.fd);
+    
+    epoll_ctl(fd_epoll, EPOLL_CTL_DEL, conn->handler.fd, NULL);
+    close(conn->handler.fd);
+    conn->handler.fd = -1;
+}
+
+
+int http_Connection_Events(Http_Connection_t* conn, uint32_t events)
+{
+    struct epoll_event event = {0};
+    
+    event.events = events;
+    event.data.ptr = &conn->handler;
+    return epoll_ctl(fd_epoll, EPOLL_CTL_MOD, conn->handler.fd, &event);
+}
+
+
+/* --- Render the header into the empty transmit buffer, contentLength -1 = chunked or until close --- */
+int http_Response_Header(Http_Connection_t* conn, const char status[], const char contentType[], int contentLength)
+{
+    char length[40] = "";
+    int len;
+    
+    if (contentLength >= 0) snprintf(length, sizeof(length), "Content-Length: %d\r\n", contentLength);
+    else if (conn->keepAlive) snprintf(length, sizeof(length), "Transfer-Encoding: chunked\r\n");
+    
+    len = snprintf(conn->txBuffer, HTTP_HEADER_SIZE, "HTTP/1.1 %s\r\nServer: %s\r\nContent-Type: %s\r\n%s%s%s%sConnection: %s\r\n\r\n",
+                   status, SOLARXD_STRING, contentType, length, conn->etag[0] ? "ETag: " : "", conn->etag, conn->etag[0] ? "\r\n" : "",
+                   conn->keepAlive ? "keep-alive" : "close");
+    if (len >= HTTP_HEADER_SIZE)
+    {
+        ERROR_MESSAGE("HTTP: Response header truncated to %d bytes", HTTP_HEADER_SIZE);
+        len = HTTP_HEADER_SIZE - 1;
+    }
+    conn->txLength = len;
+    conn->txOffset = 0;
+    conn->body = NULL;
+    conn->bodyLength = 0;
+    return len;
+}
+
+
+/* --- Response with a body rendered for this request, copied behind the header --- */
+void http_Response_Send(Http_Connection_t* conn, const char status[], const char contentType[], const char body[], int bodyLength)
+{
+    int len;
+    
+    len = http_Response_Header(conn, status, contentType, bodyLength);
+    if (body != NULL)
+    {
+        if (bodyLength > (int)sizeof(conn->txBuffer) - len) bodyLength = sizeof(conn->txBuffer) - len;
+        memcpy(&conn->txBuffer[len], body, bodyLength);
+        conn->txLength += bodyLength;
+    }
+}
+
+
+/* returns true if the client has the body of the ETag already, answered with 304 Not Modified */
+bool http_Response_NotModified(Http_Connection_t* conn, const char contentType[], uint32_t etag, int contentLength)
+{
+    snprintf(conn->etag, sizeof(conn->etag), "\"%llx-%x\"", (long long)http_StartTime, etag);
+    if (conn->ifNoneMatch[0] == '\0') return false;
+    if ((strcmp(conn->ifNoneMatch, "*") != 0) && (strstr(conn->ifNoneMatch, conn->etag) == NULL)) return false;
+    
+    http_Response_Header(conn, "304 Not Modified", contentType, contentLength);
+    return true;
+}
+
+
+/* --- Response with a pre-rendered body, sent from its buffer together with the header in one call --- */
+void http_Response_Reference(Http_Connection_t* conn, const char contentType[], const Http_Response_t* response, bool head)
+{
+    if (http_Response_NotModified(conn, contentType, response->etag, response->length)) return;
+    http_Response_Header(conn, "200 OK", contentType, response->length);
+    if (!head)
+    {
+        conn->body = response->data;
+        conn->bodyLength = response->length;
+    }
+}
+
+
+void http_Response_Error(Http_Connection_t* conn, const char status[])
+{
+    char body[64];
+    int len;
+    
+    len = sprintf(body, "%s\r\n", status);
+    conn->keepAlive = false;
+    http_Response_Send(conn, status, "text/plain", body, len);
+}
+
+
+/* returns true if the path without query is name */
+bool http_Request_Path(const char path[], const char name[])
+{
+    size_t len = strcspn(path, "?");
+    
+    return (strlen(name) == len) && (strncmp(path, name, len) == 0);
+}
+
+
+/* returns true if the query contains the parameter name */
+bool http_Query_Value(const char query[], const char name[], double* value)
+{
+    size_t len = strlen(name);
+    const char* param;
+    
+    for (param = query; param != NULL; param = strchr(param + 1, '&'))
+    {
+        if ((strncmp(param + 1, name, len) == 0) && (param[len + 1] == '='))
+        {
+            *value = strtod(param + len + 2, NULL);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/* --- Response with a body of unknown length: chunked for persistent connections, otherwise until close --- */
+void http_Response_Start(Http_Connection_t* conn, const char contentType[], int (*producer)(Http_Connection_t* conn, char buffer[], int size), bool head)
+{
+    int on = 1;
+    
+    http_Response_Header(conn, "200 OK", contentType, -1);
+    conn->producer = head ? NULL : producer;
+    
+    // the parts of the body go out in full segments, the last one is pushed when the cork is removed
+    if ((conn->producer) && (setsockopt(conn->handler.fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)) == 0)) conn->corked = true;
+}
+
+
+/* --- Render the next part of the body into the empty transmit buffer --- */
+void http_Response_Produce(Http_Connection_t* conn)
+{
+    int start = conn->keepAlive ? 6 : 0;    // room for the chunk size line
+    int len;
+    
+    len = conn->producer(conn, &conn->txBuffer[start], sizeof(conn->txBuffer) - start - 7);
+    if (conn->keepAlive)
+    {
+        // fixed width chunk size, the size line is written in front of the data
+        sprintf(conn->txBuffer, "%04x\r", len);
+        conn->txBuffer[5] = '\n';
+        len += sprintf(&conn->txBuffer[start + len], "\r\n%s", conn->producer ? "" : "0\r\n\r\n");
+    }
+    conn->txLength = start + len;
+    conn->txOffset = 0;
+}
+
+
+/* --- /history?from=&to=&step= (unix time in seconds), streamed from the mapping --- */
+void http_History_Start(Http_Connection_t* conn, const char query[])
+{
+    Http_History_t* cursor = &conn->history;
+    double value;
+    
+    *cursor = (Http_History_t) {0};
+    cursor->from = 0;
+    cursor->to = INT64_MAX;
+    if (query)
+    {
+        if (http_Query_Value(query, "from", &value)) cursor->from = (int64_t)(value * 1000);
+        if (http_Query_Value(query, "to",   &value)) cursor->to   = (int64_t)(value * 1000);
+        if (http_Query_Value(query, "step", &value)) cursor->step = (int64_t)(value * 1000);
+    }
+    if (cursor->step < 0) cursor->step = 0;
+    cursor->next = history_Find(&history_File, cursor->from);
+    cursor->bucket = -1;
+    cursor->first = true;
+}
+
+
+/* returns true if the record is the first of its inverter in the current step */
+bool http_History_Select(Http_History_t* cursor, const History_Record_t* record)
+{
+    int64_t bucket;
+    int i;
+    
+    if (cursor->step == 0) return true;
+    
+    bucket = (record->Time - cursor->from) / cursor->step;
+    if (bucket != cursor->bucket)
+    {
+        cursor->bucket = bucket;
+        cursor->sentCount = 0;
+    }
+    for (i = 0; i < cursor->sentCount; i++)
+    {
+        if (cursor->sent[i] == record->Address) return false;
+    }
+    if (cursor->sentCount < MAX_INVERTERS) cursor->sent[cursor->sentCount++] = record->Address;
+    
+    // all inverters sent, skip the rest of this step
+    if (cursor->sentCount >= http_Worker->snapshot.inverterCount)
+    {
+        cursor->next = history_Find(&history_File, cursor->from + (bucket + 1) * cursor->step);
+    }
+    return true;
+}
+
+
+int http_History_Fill(Http_Connection_t* conn, char buffer[], int size)
+{
+    Http_History_t* cursor = &conn->history;
+    History_Record_t record;
+    uint64_t written = __atomic_load_n(&history_File.header->written, __ATOMIC_ACQUIRE);
+    int len = 0;
+    
+    while (len + HISTORY_JSON_SIZE < size)
+    {
+        // records overwritten while sending are skipped
+        if (cursor->next < history_First(&history_File)) cursor->next = history_First(&history_File);
+        if (cursor->next >= written) break;
+        
+        if (!history_Read(&history_File, cursor->next++, &record)) continue;
+        if (record.Time > cursor->to) { cursor->next = written; break; }
+        if (!http_History_Select(cursor, &record)) continue;
+        
+        len += sprintf(&buffer[len], "%s{\"time\":%.3f,\"address\":%d,\"live_data\":", cursor->first ? "[\n" : ",\n", record.Time / 1000.0, record.Address);
+        len += solax_JsonLiveData(&buffer[len], &record.LiveData);
+        len += sprintf(&buffer[len], "}");
+        cursor->first = false;
+    }
+    
+    if (cursor->next >= written)
+    {
+        len += sprintf(&buffer[len], "%s]\n", cursor->first ? "[" : "\n");
+        conn->producer = NULL;
+    }
+    return len;
+}
+
+
+/* --- /rollup/<tier>?from=&address=, the buckets in time order, each read from the ring of the serial thread --- */
+void http_Rollup_Start(Http_Connection_t* conn, const Rollup_Tier_t* tier, const char query[])
+{
+    Http_Rollup_t* cursor = &conn->rollup;
+    time_t now = time(NULL);
+    struct tm infoTime;
+    double value;
+    int64_t from;
+    
+    localtime_r(&now, &infoTime);
+    *cursor = (Http_Rollup_t) {0};
+    cursor->tier = tier;
+    cursor->end = (now + infoTime.tm_gmtoff) / tier->duration + 1;
+    cursor->next = cursor->end - tier->count;
+    cursor->address = -1;
+    if (query)
+    {
+        if (http_Query_Value(query, "from", &value))
+        {
+            from = ((int64_t)value + infoTime.tm_gmtoff) / tier->duration;
+            if (from > cursor->next) cursor->next = from;
+        }
+        if (http_Query_Value(query, "address", &value)) cursor->address = (int)value;
+    }
+    cursor->first = true;
+}
+
+
+int http_Rollup_Fill(Http_Connection_t* conn, char buffer[], int size)
+{
+    Http_Rollup_t* cursor = &conn->rollup;
+    const Solax_Snapshot_t* snapshot = &http_Worker->snapshot;
+    Rollup_Bucket_t bucket;
+    Solax_LiveData_t mean;
+    int i, len = 0;
+    
+    while ((len + ROLLUP_JSON_SIZE < size) && (cursor->next < cursor->end))
+    {
+        if (cursor->index >= snapshot->inverterCount)
+        {
+            cursor->index = 0;
+            cursor->next++;
+            continue;
+        }
+        i = cursor->index++;
+        if ((cursor->address >= 0) && (snapshot->inverters[i].Address != cursor->address)) continue;
+        if (!rollup_Read(&solax_Rollups[i], cursor->tier, cursor->next, &bucket)) continue;
+        
+        rollup_Mean(&bucket, &mean);
+        len += sprintf(&buffer[len], "%s{\"time\":%lld,\"address\":%d,\"samples\":%u,\"energy\":%.1f,\"mean\":",
+                       cursor->first ? "[\n" : ",\n", (long long)bucket.start, snapshot->inverters[i].Address, bucket.count, bucket.energy);
+        len += solax_JsonLiveData(&buffer[len], &mean);
+        len += sprintf(&buffer[len], ",\"min\":");
+        len += solax_JsonLiveData(&buffer[len], &bucket.min);
+        len += sprintf(&buffer[len], ",\"max\":");
+        len += solax_JsonLiveData(&buffer[len], &bucket.max);
+        len += sprintf(&buffer[len], ",\"last\":");
+        len += solax_JsonLiveData(&buffer[len], &bucket.last);
+        len += sprintf(&buffer[len], "}");
+        cursor->first = false;
+    }
+    
+    if (cursor->next >= cursor->end)
+    {
+        len += sprintf(&buffer[len], "%s]\n", cursor->first ? "[" : "\n");
+        conn->producer = NULL;
+    }
+    return len;
+}
+
+
+/* --- /metrics in Prometheus text format, one metric family after the other --- */
+int http_Metrics_Histogram(char buffer[], const char name[], const Metrics_Histogram_t* histogram)
+{
+    uint64_t count = 0;
+    int i, len = 0;
+    
+    uint64_t total = __atomic_load_n(&histogram->total, __ATOMIC_RELAXED);
+    double sum;
+    
+    __atomic_load(&histogram->sum, &sum, __ATOMIC_RELAXED);
+    for (i = 0; i < METRICS_BUCKET_COUNT; i++)
+    {
+        count += __atomic_load_n(&histogram->count[i], __ATOMIC_RELAXED);
+        len += sprintf(&buffer[len], "%s_bucket{le=\"%g\"} %llu\n", name, histogram->bounds[i], (unsigned long long)count);
+    }
+    len += sprintf(&buffer[len], "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)total);
+    len += sprintf(&buffer[len], "%s_sum %.6f\n", name, sum);
+    len += sprintf(&buffer[len], "%s_count %llu\n", name, (unsigned long long)total);
+    return len;
+}
+
+
+/* families 0..2 are global, for all others index -1 renders the HELP and TYPE lines, otherwise the samples of inverter index */
+int http_Metrics_Family(char buffer[], int family, int index)
+{
+    static const char* stateNames[] = { "broadcast", "inverter_address", "query_live_data" };
+    static const char* responseNames[] = { "ok", "no_data", "invalid_msg", "crc_error" };
+    const Solax_Snapshot_t* snapshot = &http_Worker->snapshot;
+    const Solax_Snapshot_Inverter_t* inverter = (index >= 0) ? &snapshot->inverters[index] : NULL;
+    char name[64];
+    char fieldName[48];
+    int i, j, len = 0;
+    
+    switch (family)
+    {
+        case 0:
+            // global counters of the serial interface
+            len += sprintf(&buffer[len], "# HELP solax_rx_bytes_total Bytes received from the RS485 bus.\n# TYPE solax_rx_bytes_total counter\n");
+            len += sprintf(&buffer[len], "solax_rx_bytes_total %llu\n", (unsigned long long)snapshot->metrics.rxBytes);
+            len += sprintf(&buffer[len], "# HELP solax_rx_frames_total Frames received with valid checksum.\n# TYPE solax_rx_frames_total counter\n");
+            len += sprintf(&buffer[len], "solax_rx_frames_total %llu\n", (unsigned long long)snapshot->metrics.rxFrames);
+            len += sprintf(&buffer[len], "# HELP solax_rx_discarded_bytes_total Bytes skipped while searching a frame header.\n# TYPE solax_rx_discarded_bytes_total counter\n");
+            len += sprintf(&buffer[len], "solax_rx_discarded_bytes_total %llu\n", (unsigned long long)snapshot->metrics.rxDiscarded);
+            len += sprintf(&buffer[len], "# HELP solax_tx_frames_total Frames sent to the RS485 bus.\n# TYPE solax_tx_frames_total counter\n");
+            len += sprintf(&buffer[len], "solax_tx_frames_total %llu\n", (unsigned long long)snapshot->metrics.txFrames);
+            len += sprintf(&buffer[len], "# HELP solax_log_dropped_total Log messages dropped because the log ring was full.\n# TYPE solax_log_dropped_total counter\n");
+            len += sprintf(&buffer[len], "solax_log_dropped_total %u\n", __atomic_load_n(&log_Ring.dropped, __ATOMIC_RELAXED));
+            return len;
+        case 1:
+            len += sprintf(&buffer[len], "# HELP solax_query_latency_seconds Time from query sent until response frame completed.\n# TYPE solax_query_latency_seconds histogram\n");
+            len += http_Metrics_Histogram(&buffer[len], "solax_query_latency_seconds", &snapshot->metrics.queryLatency);
+            return len;
+        case 2:
+            len += sprintf(&buffer[len], "# HELP solax_http_serve_seconds Time from HTTP request received until response written.\n# TYPE solax_http_serve_seconds histogram\n");
+            len += http_Metrics_Histogram(&buffer[len], "solax_http_serve_seconds", &metrics_Serve);
+            return len;
+        case 3:
+            if (index < 0) return sprintf(buffer, "# HELP solax_queries_total Queries per query state.\n# TYPE solax_queries_total counter\n");
+            for (i = 0; i < 3; i++)
+            {
+                len += sprintf(&buffer[len], "solax_queries_total{address=\"%d\",state=\"%s\"} %llu\n", inverter->Address, stateNames[i], (unsigned long long)inverter->Counters.queries[i]);
+            }
+            return len;
+        case 4:
+            if (index < 0) return sprintf(buffer, "# HELP solax_responses_total Query results, ok or the error.\n# TYPE solax_responses_total counter\n");
+            for (i = 0; i < ERR_INCOMPLETE; i++)
+            {
+                len += sprintf(&buffer[len], "solax_responses_total{address=\"%d\",result=\"%s\"} %llu\n", inverter->Address, responseNames[i], (unsigned long long)inverter->Counters.responses[i]);
+            }
+            return len;
+        case 5:
+            if (index < 0) return sprintf(buffer, "# HELP solax_state_changes_total Changes of the query state.\n# TYPE solax_state_changes_total counter\n");
+            for (i = 0; i < 3; i++)
+            {
+                for (j = 0; j < 3; j++)
+                {
+                    if (i == j) continue;
+                    len += sprintf(&buffer[len], "solax_state_changes_total{address=\"%d\",from=\"%s\",to=\"%s\"} %llu\n", inverter->Address, stateNames[i], stateNames[j], (unsigned long long)inverter->Counters.stateChanges[i][j]);
+                }
+            }
+            return len;
+        case 6:
+            if (index < 0) return sprintf(buffer, "# HELP solax_query_state Current query state, 0=broadcast 1=inverter_address 2=query_live_data.\n# TYPE solax_query_state gauge\n");
+            return sprintf(buffer, "solax_query_state{address=\"%d\"} %d\n", inverter->Address, inverter->StateQuery);
+        default:
+            // gauges of the fields, e.g. solax_live_data_power for "live_data/power"
+            snprintf(name, sizeof(name), "solax_%s", solax_FieldName(family - 7, fieldName, sizeof(fieldName)));
+            for (i = 0; name[i]; i++) if (name[i] == '/') name[i] = '_';
+            if (index < 0) return sprintf(buffer, "# HELP %s Averaged live data.\n# TYPE %s gauge\n", name, name);
+            return sprintf(buffer, "%s{address=\"%d\"} %.6g\n", name, inverter->Address, solax_FieldValue(inverter, family - 7));
+    }
+}
+
+
+int http_Metrics_Fill(Http_Connection_t* conn, char buffer[], int size)
+{
+    Http_Metrics_t* cursor = &conn->metrics;
+    int len = 0;
+    
+    while (len + METRICS_PART_SIZE < size)
+    {
+        if (cursor->family >= METRICS_FAMILY_COUNT)
+        {
+            conn->producer = NULL;
+            break;
+        }
+        
+        len += http_Metrics_Family(&buffer[len], cursor->family, cursor->index);
+        
+        cursor->index++;
+        if ((cursor->family < 3) || (cursor->index >= http_Worker->snapshot.inverterCount))
+        {
+            cursor->family++;
+            cursor->index = -1;
+        }
+    }
+    return len;
+}
+
+
+/* --- /timing: the last exchanges, times in milliseconds after the query was written --- */
+int http_Timing_Time(char buffer[], const char name[], int64_t time, int64_t txTime)
+{
+    if (time == 0) return sprintf(buffer, ",\"%s\":null", name);
+    return sprintf(buffer, ",\"%s\":%.3f", name, (time - txTime) / 1e6);
+}
+
+
+int http_Timing_Fill(Http_Connection_t* conn, char buffer[], int size)
+{
+    Http_Timing_t* cursor = &conn->timing;
+    Timing_Record_t record;
+    int len = 0;
+    
+    while ((len + TIMING_JSON_SIZE < size) && (cursor->next < cursor->end))
+    {
+        if (!timing_Read(cursor->next, &record)) { cursor->next++; continue; }
+        
+        len += sprintf(&buffer[len], "%s{\"sequence\":%u,\"bus\":%d,\"address\":%d,\"state\":%d,\"result\":%d,\"tx_bytes\":%d,\"rx_bytes\":%d",
+                       cursor->first ? "[\n" : ",\n", record.sequence, record.bus, record.address, record.state, record.result, record.txBytes, record.rxBytes);
+        len += sprintf(&buffer[len], ",\"tx_time\":%.6f,\"tx_wire\":%.3f", record.txTime / 1e9, record.txBytes * 10 * 1000.0 / 9600);
+        len += http_Timing_Time(&buffer[len], "rx_first", record.rxFirstTime, record.txTime);
+        len += http_Timing_Time(&buffer[len], "rx_frame", record.rxFrameTime, record.txTime);
+        len += http_Timing_Time(&buffer[len], "end", record.endTime, record.txTime);
+        len += sprintf(&buffer[len], "}");
+        cursor->first = false;
+        cursor->next++;
+    }
+    
+    if (cursor->next >= cursor->end)
+    {
+        len += sprintf(&buffer[len], "%s]\n", cursor->first ? "[" : "\n");
+        conn->producer = NULL;
+    }
+    return len;
+}
+
+
+/* --- /inverter/[<INDEX>/]<FIELD>: one value of the JSON-Path document, e.g. /inverter/live_data/power --- */
+void http_Field_Send(Http_Connection_t* conn, const char path[], bool head)
+{
+    const Solax_Snapshot_t* snapshot = &http_Worker->snapshot;
+    char fieldName[48];
+    char body[32];
+    char* end;
+    long index = 0;
+    int i, len;
+    
+    // the index of the inverter in the array, only needed for more inverters
+    if (isdigit((unsigned char)path[0]))
+    {
+        index = strtol(path, &end, 10);
+        path = (*end == '/') ? end + 1 : "";
+    }
+    for (i = 0; (i < LIVE_FIELD_COUNT) && !http_Request_Path(path, solax_FieldName(i, fieldName, sizeof(fieldName))); i++);
+    if ((i == LIVE_FIELD_COUNT) || (index >= snapshot->inverterCount))
+    {
+        http_Response_Error(conn, "404 Not Found");
+        return;
+    }
+    
+    // unchanged while the document is unchanged, it shares the ETag
+    len = snprintf(body, sizeof(body), "%.*f\r\n", solax_FieldPrecision(i), solax_FieldValue(&snapshot->inverters[index], i));
+    if (http_Response_NotModified(conn, "text/plain", http_Worker->response.etag, len)) return;
+    http_Response_Send(conn, "200 OK", "text/plain", head ? NULL : body, len);
+}
+
+
+/* --- Request routing, all paths not listed serve the JSON live data --- */
+void http_Request_Route(Http_Connection_t* conn, const char method[], const char path[])
+{
+    bool head = (strcmp(method, "HEAD") == 0);
+    const char* query;
+    int i, len = 0;
+    
+    if ((strcmp(method, "GET") != 0) && !head)
+    {
+        http_Response_Error(conn, "405 Method Not Allowed");
+        return;
+    }
+    
+    query = strchr(path, '?');
+    
+    if (http_Request_Path(path, "/history"))
+    {
+        if (history_File.header == NULL)
+        {
+            http_Response_Error(conn, "404 Not Found");
+            return;
+        }
+        http_History_Start(conn, query);
+        http_Response_Start(conn, "application/json", http_History_Fill, head);
+        return;
+    }
+    
+    if (http_Request_Path(path, "/metrics"))
+    {
+        conn->metrics.family = 0;
+        conn->metrics.index = -1;
+        http_Response_Start(conn, "text/plain; version=0.0.4", http_Metrics_Fill, head);
+        return;
+    }
+    
+    if (http_Request_Path(path, "/timing"))
+    {
+        conn->timing.end = __atomic_load_n(&timing_Ring.written, __ATOMIC_ACQUIRE);
+        conn->timing.next = (conn->timing.end >= TIMING_RECORD_COUNT) ? conn->timing.end - TIMING_RECORD_COUNT + 1 : 0;
+        conn->timing.first = true;
+        http_Response_Start(conn, "application/json", http_Timing_Fill, head);
+        return;
+    }
+    
+    if (strncmp(path, "/inverter/", 10) == 0)
+    {
+        http_Field_Send(conn, path + 10, head);
+        return;
+    }
+    
+    if (strncmp(path, "/rollup/", 8) == 0)
+    {
+        for (i = 0; (i < ROLLUP_TIER_COUNT) && !http_Request_Path(path + 8, rollup_Tiers[i].name); i++);
+        if (i == ROLLUP_TIER_COUNT)
+        {
+            http_Response_Error(conn, "404 Not Found");
+            return;
+        }
+        http_Rollup_Start(conn, &rollup_Tiers[i], query);
+        http_Response_Start(conn, "application/json", http_Rollup_Fill, head);
+        return;
+    }
+    
+    if (http_Request_Path(path, "/live.bin"))
+    {
+        http_Response_Reference(conn, "application/octet-stream", &http_Worker->responseBinary, head);
+        return;
+    }
+    
+    if (http_Request_Path(path, "/stream"))
+    {
+        // server-sent events, "/stream?raw=1" for the live data of each received frame
+        len = snprintf(conn->txBuffer, HTTP_HEADER_SIZE, "HTTP/1.1 200 OK\r\nServer: %s\r\nContent-Type: text/event-stream\r\n"
+                       "Cache-Control: no-cache\r\nConnection: keep-alive\r\n\r\n", SOLARXD_STRING);
+        conn->txLength = len;
+        conn->txOffset = 0;
+        conn->body = NULL;
+        conn->bodyLength = 0;
+        conn->stream = (query && strstr(query, "raw=1")) ? STREAM_RAW : STREAM_SAMPLE;
+        DEBUG_MESSAGE("HTTP: Connection %d subscribed to %s stream", conn->handler.fd, (conn->stream == STREAM_RAW) ? "raw" : "sample");
+        return;
+    }
+    
+    http_Response_Reference(conn, "application/json", &http_Worker->response, head);
+}
+
+
+/* returns length of the parsed request, 0 if the request is incomplete */
+int http_Request_Parse(Http_Connection_t* conn)
+{
+    char method[8], path[256];
+    int versionMajor, versionMinor;
+    char* end;
+    char* line;
+    
+    conn->rxBuffer[conn->rxLength] = '\0';
+    end = strstr(conn->rxBuffer, "\r\n\r\n");
+    if (end == NULL) return 0;
+    *end = '\0';
+    conn->requestTime = metrics_Now();
+    
+    if (sscanf(conn->rxBuffer, "%7s %255s HTTP/%d.%d", method, path, &versionMajor, &versionMinor) != 4)
+    {
+        http_Response_Error(conn, "400 Bad Request");
+        return end + 4 - conn->rxBuffer;
+    }
+    
+    // HTTP/1.1 is persistent by default, HTTP/1.0 only on request
+    conn->keepAlive = (versionMajor > 1) || ((versionMajor == 1) && (versionMinor >= 1));
+    conn->ifNoneMatch[0] = '\0';
+    conn->etag[0] = '\0';
+    for (line = strstr(conn->rxBuffer, "\r\n"); line != NULL; line = strstr(line + 2, "\r\n"))
+    {
+        if (strncasecmp(line + 2, "Connection:", 11) == 0)
+        {
+            if (strcasestr(line + 13, "close"))      conn->keepAlive = false;
+            if (strcasestr(line + 13, "keep-alive")) conn->keepAlive = true;
+        }
+        if (strncasecmp(line + 2, "If-None-Match:", 14) == 0)
+        {
+            sscanf(line + 16, " %63[^\r]", conn->ifNoneMatch);
+        }
+    }
+    
+    DEBUG_MESSAGE("HTTP: Request '%s %s' on connection %d", method, path, conn->handler.fd);
+    
+    http_Request_Route(conn, method, path);
+    return end + 4 - conn->rxBuffer;
+}
+
+
+/* --- Write the rest of the transmit buffer and the body with one call, returns the count of written bytes --- */
+ssize_t http_Connection_Write(Http_Connection_t* conn)
+{
+    struct iovec iov[2];
+    struct msghdr msg = {0};
+    int offset = conn->txOffset;
+    
+    msg.msg_iov = iov;
+    if (offset < conn->txLength)
+    {
+        iov[msg.msg_iovlen].iov_base = &conn->txBuffer[offset];
+        iov[msg.msg_iovlen].iov_len = conn->txLength - offset;
+        msg.msg_iovlen++;
+        offset = conn->txLength;
+    }
+    if (conn->bodyLength)
+    {
+        iov[msg.msg_iovlen].iov_base = (char*)&conn->body[offset - conn->txLength];
+        iov[msg.msg_iovlen].iov_len = conn->txLength + conn->bodyLength - offset;
+        msg.msg_iovlen++;
+    }
+    return sendmsg(conn->handler.fd, &msg, MSG_NOSIGNAL);
+}
+
+
+/* --- Send the pending response, parse the next request when done --- */
+int http_Connection_Process(Http_Connection_t* conn)
+{
+    int len, off = 0;
+    
+    while (1)
+    {
+        while (conn->txOffset < conn->txLength + conn->bodyLength)
+        {
+            len = http_Connection_Write(conn);
+            if (len < 0)
+            {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN)
+                {
+                    // continue when the socket is writable again
+                    http_Connection_Events(conn, EPOLLOUT);
+                    return 0;
+                }
+                http_Connection_Close(conn);
+                return 0;
+            }
+            conn->txOffset += len;
+        }
+        
+        if (conn->producer)
+        {
+            http_Response_Produce(conn);
+            continue;
+        }
+        
+        if (conn->corked)
+        {
+            setsockopt(conn->handler.fd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+            conn->corked = false;
+        }
+        
+        if (conn->stream)
+        {
+            // stream remains open, further requests are ignored
+            conn->txLength = 0;
+            conn->txOffset = 0;
+            http_Connection_Events(conn, EPOLLIN);
+            return 0;
+        }
+        
+        if (conn->txLength)
+        {
+            conn->txLength = 0;
+            conn->txOffset = 0;
+            conn->body = NULL;
+            conn->bodyLength = 0;
+            metrics_Observe(&metrics_Serve, metrics_Now() - conn->requestTime);
+            if (!conn->keepAlive)
+            {
+                http_Connection_Close(conn);
+                return 0;
+            }
+            http_Connection_Events(conn, EPOLLIN);
+        }
+        
+        // pipelined requests
+        len = http_Request_Parse(conn);
+        if (len == 0) return 0;
+        memmove(conn->rxBuffer, &conn->rxBuffer[len], conn->rxLength - len);
+        conn->rxLength -= len;
+    }
+}
+
+
+int poll_HTTP_Connection(Event_Handler_t* handler, uint32_t events)
+{
+    Http_Connection_t* conn = (Http_Connection_t*)handler;
+    int len;
+    
+    conn->lastActivity = http_Time();
+    
+    if (events & EPOLLIN)
+    {
+        len = read(handler->fd, &conn->rxBuffer[conn->rxLength], sizeof(conn->rxBuffer) - 1 - conn->rxLength);
+        if ((len < 0) && ((errno == EAGAIN) || (errno == EINTR))) return 0;
+        if (len <= 0)
+        {
+            http_Connection_Close(conn);    // closed by client
+            return 0;
+        }
+        conn->rxLength += len;
+        if (conn->stream) conn->rxLength = 0;
+        
+        if ((conn->rxLength == sizeof(conn->rxBuffer) - 1) && (strstr(conn->rxBuffer, "\r\n\r\n") == NULL) && (conn->txLength == 0))
+        {
+            http_Response_Error(conn, "431 Request Header Fields Too Large");
+            conn->rxLength = 0;
+        }
+    }
+    else if (events & (EPOLLHUP | EPOLLERR))
+    {
+        http_Connection_Close(conn);
+        return 0;
+    }
+    
+    return http_Connection_Process(conn);
+}
+
+
+/* --- Close connections idle for more than HTTP_KEEPALIVE_TIMEOUT --- */
+void http_Connection_Timeout(void)
+{
+    int i;
+    time_t now = http_Time();
+    Http_Connection_t* conn;
+    
+    if (now == http_Worker->lastTimeout) return;
+    http_Worker->lastTimeout = now;
+    
+    for (i = 0; i < MAX_HTTP_CLIENTS; i++)
+    {
+        conn = &http_Worker->connections[i];
+        if ((conn->handler.fd >= 0) && (conn->stream == STREAM_NONE) && (now - conn->lastActivity > HTTP_KEEPALIVE_TIMEOUT))
+        {
+            http_Connection_Close(conn);
+        }
+    }
+}
+
+
+int poll_HTTP_Server(Event_Handler_t* handler, uint32_t events)
+{
+    int fd_sock_client;
+    int i, one = 1;
+    Http_Connection_t* conn;
+    (void)events;
+
+    // accept all pending connections
+    while (1)
+    {
+        fd_sock_client = accept4(handler->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+     
+        if (fd_sock_client == -1)
+        {
+            if ((errno == EWOULDBLOCK) || (errno == EINTR) || (errno == ECONNABORTED)) break;
+            ERROR_MESSAGE("Http: Error when accepting HTTP-Client connection: %s", strerror(errno));
+            return -1;
+        }
+        
+        conn = NULL;
+        for (i = 0; i < MAX_HTTP_CLIENTS; i++)
+        {
+            if (http_Worker->connections[i].handler.fd < 0) { conn = &http_Worker->connections[i]; break; }
+        }
+        if (conn == NULL)
+        {
+            NOTICE_MESSAGE("HTTP: Too many connections, maximum is %d", MAX_HTTP_CLIENTS);
+            close(fd_sock_client);
+            continue;
+        }
+        
+        DEBUG_MESSAGE("HTTP: Got a connection %d", fd_sock_client);
+        
+        // responses are written in one call, there is nothing to coalesce
+        setsockopt(fd_sock_client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        
+        conn->handler.fd = fd_sock_client;
+        conn->handler.callback = poll_HTTP_Connection;
+        conn->rxLength = 0;
+        conn->txLength = 0;
+        conn->txOffset = 0;
+        conn->body = NULL;
+        conn->bodyLength = 0;
+        conn->corked = false;
+        conn->keepAlive = false;
+        conn->stream = STREAM_NONE;
+        conn->producer = NULL;
+        conn->lastActivity = http_Time();
+        if (init_Event_Handler(&conn->handler, EPOLLIN) == -1)
+        {
+            close(fd_sock_client);
+            conn->handler.fd = -1;
+        }
+    }
+    return 0;
+}
+
+
+/* --- Serialize one event and push it to all subscribers of the stream --- */
+void http_Stream_Publish(Http_Stream_t stream, const Solax_Snapshot_Inverter_t* inverter, const Solax_LiveData_t* liveData)
+{
+    char event[HTTP_EVENT_SIZE];
+    int i, len = 0;
+    Http_Connection_t* conn;
+    
+    for (i = 0; i < MAX_HTTP_CLIENTS; i++)
+    {
+        conn = &http_Worker->connections[i];
+        if ((conn->handler.fd < 0) || (conn->stream != stream)) continue;
+        
+        if (len == 0)
+        {
+            len += sprintf(&event[len], "id: %u\n", http_Worker->snapshot.generation);
+            len += sprintf(&event[len], "event: %s\n", (stream == STREAM_RAW) ? "raw" : "sample");
+            len += sprintf(&event[len], "data: ");
+            len += solax_JsonCompact(&event[len], inverter, liveData);
+            len += sprintf(&event[len], "\n\n");
+        }
+        
+        // a slow client misses events instead of buffering them without limit
+        if ((conn->txOffset) && (conn->txOffset == conn->txLength))
+        {
+            conn->txLength = 0;
+            conn->txOffset = 0;
+        }
+        if (conn->txLength + len > (int)sizeof(conn->txBuffer))
+        {
+            DEBUG_MESSAGE("HTTP: Event dropped for slow connection %d", conn->handler.fd);
+            continue;
+        }
+        memcpy(&conn->txBuffer[conn->txLength], event, len);
+        conn->txLength += len;
+        
+        http_Connection_Process(conn);
+    }
+}
+
+
+/* --- HTTP front-end threads: each serves its own connections, rendered from its copy of the snapshot --- */
+void http_Snapshot_Read(Solax_Snapshot_t* copy)
+{
+    uint32_t sequence;
+    
+    do
+    {
+        while ((sequence = __atomic_load_n(&solax_Snapshot.sequence, __ATOMIC_ACQUIRE)) & 1);
+        memcpy(copy, &solax_Snapshot, sizeof(*copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&solax_Snapshot.sequence, __ATOMIC_RELAXED) != sequence);
+}
+
+
+/* --- Take the new snapshot, render the responses once and push the events of the new samples --- */
+void http_Worker_Update(void)
+{
+    Http_Worker_t* worker = http_Worker;
+    const Solax_Snapshot_Inverter_t* inverter;
+    uint32_t sampleCount[MAX_INVERTERS];
+    int i, count = worker->snapshot.inverterCount;
+    
+    for (i = 0; i < count; i++)
+    {
+        sampleCount[i] = worker->snapshot.inverters[i].SampleCount;
+    }
+    
+    http_Snapshot_Read(&worker->snapshot);
+    http_Response_Build(&worker->response, &worker->snapshot);
+    http_Response_BuildBinary(&worker->responseBinary, &worker->snapshot);
+    
+    // samples replaced by a newer one before this thread got the snapshot are not streamed
+    for (i = 0; i < worker->snapshot.inverterCount; i++)
+    {
+        inverter = &worker->snapshot.inverters[i];
+        if ((inverter->SampleCount == 0) || ((i < count) && (inverter->SampleCount == sampleCount[i]))) continue;
+        
+        if (inverter->Sample.valid) http_Stream_Publish(STREAM_RAW, inverter, &inverter->Sample);
+        http_Stream_Publish(STREAM_SAMPLE, inverter, &inverter->LiveData);
+    }
+}
+
+
+int poll_HTTP_Notify(Event_Handler_t* handler, uint32_t events)
+{
+    uint64_t count;
+    (void)events;
+    
+    if (read(handler->fd, &count, sizeof(count)) != sizeof(count)) return 0;
+    
+    http_Worker_Update();
+    return 0;
+}
+
+
+void* http_Worker_Run(void* arg)
+{
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    Event_Handler_t* handler;
+    int i, count;
+    
+    http_Worker = arg;
+    fd_epoll = http_Worker->fd_epoll;
+    http_Worker_Update();
+    
+    while (1)
+    {
+        count = epoll_wait(fd_epoll, events, MAX_EPOLL_EVENTS, 1000);
+        if (count == -1)
+        {
+            if (errno == EINTR) continue;
+            ERROR_MESSAGE("HTTP: Error waiting for events: %s", strerror(errno));
+            exit(errno);
+        }
+        
+        for (i = 0; i < count; i++)
+        {
+            handler = events[i].data.ptr;
+            if (handler->callback(handler, events[i].events) == -1) exit(errno);
+        }
+        http_Connection_Timeout();
+    }
+    return NULL;
+}
+
+
+/* --- MQTT publisher: retained topic per field, only changed values are published --- */
+int mqtt_EncodeLength(uint8_t buffer[], int length)
+{
+    int len = 0;
+    
+    do
+    {
+        buffer[len] = length % 128;
+        length /= 128;
+        if (length) buffer[len] |= 0x80;
+        len++;
+    } while (length);
+    return len;
+}
+
+
+int mqtt_EncodeString(uint8_t buffer[], const char str[])
+{
+    int len = strlen(str);
+    
+    buffer[0] = highByte(len);
+    buffer[1] = lowByte(len);
+    memcpy(&buffer[2], str, len);
+    return len + 2;
+}
+
+
+/* returns false if the packet does not fit into the send buffer */
+bool mqtt_Packet_Publish(Mqtt_Client_t* client, const char topic[], const char payload[])
+{
+    uint8_t* buffer = &client->txBuffer[client->txLength];
+    int topicLen = strlen(topic);
+    int payloadLen = strlen(payload);
+    int remaining = 2 + topicLen + payloadLen;
+    int len = 0;
+    
+    if (client->txLength + remaining + 5 > (int)sizeof(client->txBuffer)) return false;
+    
+    buffer[len++] = 0x31;    // PUBLISH, QoS 0, retain
+    len += mqtt_EncodeLength(&buffer[len], remaining);
+    len += mqtt_EncodeString(&buffer[len], topic);
+    memcpy(&buffer[len], payload, payloadLen);
+    len += payloadLen;
+    
+    client->txLength += len;
+    return true;
+}
+
+
+void mqtt_Packet_Connect(Mqtt_Client_t* client)
+{
+    uint8_t* buffer = client->txBuffer;
+    uint8_t payload[256];
+    char clientId[32];
+    char willTopic[128];
+    int len = 0, payloadLen = 0;
+    
+    snprintf(clientId, sizeof(clientId), "solaxd-%d", (int)getpid());
+    snprintf(willTopic, sizeof(willTopic), "%s/status", arg_MqttTopic);
+    
+    payloadLen += mqtt_EncodeString(&payload[payloadLen], clientId);
+    payloadLen += mqtt_EncodeString(&payload[payloadLen], willTopic);
+    payloadLen += mqtt_EncodeString(&payload[payloadLen], "offline");
+    
+    buffer[len++] = 0x10;    // CONNECT
+    len += mqtt_EncodeLength(&buffer[len], 10 + payloadLen);
+    len += mqtt_EncodeString(&buffer[len], "MQTT");
+    buffer[len++] = 0x04;    // protocol level 3.1.1
+    buffer[len++] = 0x26;    // clean session, will flag, will retain
+    buffer[len++] = highByte(MQTT_KEEPALIVE);
+    buffer[len++] = lowByte(MQTT_KEEPALIVE);
+    memcpy(&buffer[len], payload, payloadLen);
+    len += payloadLen;
+    
+    client->txLength = len;
+}
+
+
+void mqtt_Disconnect(Mqtt_Client_t* client)
+{
+    if (client->handler.fd >= 0)
+    {
+        epoll_ctl(fd_epoll, EPOLL_CTL_DEL, client->handler.fd, NULL);
+        close(client->handler.fd);
+        client->handler.fd = -1;
+    }
+    if (client->state == MQTT_CONNECTED) NOTICE_MESSAGE("MQTT: Disconnected from broker '%s'", arg_MqttBroker);
+    
+    // reconnect with exponential backoff
+    client->state = MQTT_DISCONNECTED;
+    client->txLength = 0;
+    client->rxLength = 0;
+    client->reconnectTime = http_Time() + client->backoff;
+    client->backoff = (client->backoff * 2 > MQTT_BACKOFF_MAX) ? MQTT_BACKOFF_MAX : client->backoff * 2;
+}
+
+
+/* --- Write pending packets, never waits for the broker --- */
+void mqtt_Flush(Mqtt_Client_t* client)
+{
+    struct epoll_event event = {0};
+    int len;
+    
+    while (client->txLength)
+    {
+        len = send(client->handler.fd, client->txBuffer, client->txLength, MSG_NOSIGNAL);
+        if (len < 0)
+        {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) break;
+            DEBUG_MESSAGE("MQTT: Error sending data: %s", strerror(errno));
+            mqtt_Disconnect(client);
+            return;
+        }
+        memmove(client->txBuffer, &client->txBuffer[len], client->txLength - len);
+        client->txLength -= len;
+        client->lastTx = http_Time();
+    }
+    
+    event.events = EPOLLIN | (client->txLength ? EPOLLOUT : 0);
+    event.data.ptr = &client->handler;
+    epoll_ctl(fd_epoll, EPOLL_CTL_MOD, client->handler.fd, &event);
+}
+
+
+/* --- Queue all changed values of the inverter as one batch --- */
+void mqtt_Publish_Inverter(Mqtt_Client_t* client, const Solax_Snapshot_Inverter_t* inverter)
+{
+    char topic[128];
+    char fieldName[48];
+    char payload[16];
+    char* published;
+    double value, last, delta;
+    int i;
+    int index = inverter - solax_Snapshot.inverters;
+    
+    if (client->state != MQTT_CONNECTED) return;
+    
+    for (i = 0; i < LIVE_FIELD_COUNT; i++)
+    {
+        published = client->published[index][i];
+        value = solax_FieldValue(inverter, i);
+        snprintf(payload, sizeof(payload), "%.*f", solax_FieldPrecision(i), value);
+        if (strcmp(payload, published) == 0) continue;
+        
+        // deadband relative to the retained value
+        if ((published[0]) && (arg_MqttDeadband > 0))
+        {
+            last = atof(published);
+            delta = (value > last) ? (value - last) : (last - value);
+            if (delta * 100 <= arg_MqttDeadband * ((last < 0) ? -last : last)) continue;
+        }
+        
+        snprintf(topic, sizeof(topic), "%s/%d/%s", arg_MqttTopic, inverter->Address, solax_FieldName(i, fieldName, sizeof(fieldName)));
+        if (!mqtt_Packet_Publish(client, topic, payload)) break;    // send buffer full, published with next sample
+        strcpy(published, payload);
+    }
+    
+    mqtt_Flush(client);
+}
+
+
+int mqtt_Connect(Mqtt_Client_t* client)
+{
+    client->handler.fd = socket(client->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (client->handler.fd == -1) { ERROR_MESSAGE("MQTT: Error opening socket: %s", strerror(errno)); return -1; }
+    
+    if ((connect(client->handler.fd, (struct sockaddr*)&client->addr, client->addrLen) == -1) && (errno != EINPROGRESS))
+    {
+        DEBUG_MESSAGE("MQTT: Error connecting broker '%s': %s", arg_MqttBroker, strerror(errno));
+        close(client->handler.fd);
+        client->handler.fd = -1;
+        mqtt_Disconnect(client);
+        return 0;
+    }
+    
+    client->state = MQTT_CONNECTING;
+    if (init_Event_Handler(&client->handler, EPOLLOUT) == -1) return -1;
+    return 0;
+}
+
+
+int poll_MQTT_Client(Event_Handler_t* handler, uint32_t events)
+{
+    Mqtt_Client_t* client = (Mqtt_Client_t*)handler;
+    int error = 0, len;
+    socklen_t errorLen = sizeof(error);
+    char topic[128];
+    
+    if (client->state == MQTT_CONNECTING)
+    {
+        getsockopt(handler->fd, SOL_SOCKET, SO_ERROR, &error, &errorLen);
+        if (error)
+        {
+            DEBUG_MESSAGE("MQTT: Error connecting broker '%s': %s", arg_MqttBroker, strerror(error));
+            mqtt_Disconnect(client);
+            return 0;
+        }
+        client->state = MQTT_WAIT_CONNACK;
+        mqtt_Packet_Connect(client);
+        mqtt_Flush(client);
+        return 0;
+    }
+    
+    if (events & EPOLLIN)
+    {
+        len = read(handler->fd, &client->rxBuffer[client->rxLength], sizeof(client->rxBuffer) - client->rxLength);
+        if ((len < 0) && ((errno == EAGAIN) || (errno == EINTR))) return 0;
+        if (len <= 0)
+        {
+            mqtt_Disconnect(client);
+            return 0;
+        }
+        client->rxLength += len;
+        
+        // only CONNACK and PINGRESP are expected, both with 2 bytes
+        while (client->rxLength >= 2)
+        {
+            len = 2 + client->rxBuffer[1];
+            if (len > (int)sizeof(client->rxBuffer)) { mqtt_Disconnect(client); return 0; }
+            if (client->rxLength < len) break;
+            
+            if ((client->rxBuffer[0] == 0x20) && (client->state == MQTT_WAIT_CONNACK))
+            {
+                if (client->rxBuffer[3] != 0)
+                {
+                    ERROR_MESSAGE("MQTT: Connection refused by broker '%s', return code %d", arg_MqttBroker, client->rxBuffer[3]);
+                    mqtt_Disconnect(client);
+                    return 0;
+                }
+                NOTICE_MESSAGE("MQTT: Connected to broker '%s'", arg_MqttBroker);
+                client->state = MQTT_CONNECTED;
+                client->backoff = 1;
+                memset(client->published, 0, sizeof(client->published));    // publish all values again
+                snprintf(topic, sizeof(topic), "%s/status", arg_MqttTopic);
+                mqtt_Packet_Publish(client, topic, "online");
+            }
+            memmove(client->rxBuffer, &client->rxBuffer[len], client->rxLength - len);
+            client->rxLength -= len;
+        }
+    }
+    else if (events & (EPOLLHUP | EPOLLERR))
+    {
+        mqtt_Disconnect(client);
+        return 0;
+    }
+    
+    mqtt_Flush(client);
+    return 0;
+}
+
+
+/* --- Reconnect and keep-alive, called once per query interval --- */
+int mqtt_Timer(Mqtt_Client_t* client)
+{
+    time_t now = http_Time();
+    
+    if (arg_MqttBroker == NULL) return 0;
+    
+    if ((client->state == MQTT_DISCONNECTED) && (now >= client->reconnectTime))
+    {
+        return mqtt_Connect(client);
+    }
+    
+    if ((client->state == MQTT_CONNECTED) && (now - client->lastTx >= MQTT_KEEPALIVE / 2) && (client->txLength + 2 <= (int)sizeof(client->txBuffer)))
+    {
+        client->txBuffer[client->txLength++] = 0xC0;    // PINGREQ
+        client->txBuffer[client->txLength++] = 0x00;
+        mqtt_Flush(client);
+    }
+    return 0;
+}
+
+
+/* "host" or "host:port", returns the error of getaddrinfo() */
+int net_Resolve(const char name[], int defaultPort, struct sockaddr_storage* addr, socklen_t* addrLen)
+{
+    struct addrinfo hints = {0};
+    struct addrinfo* result;
+    char host[256];
+    char port[8];
+    char* sep;
+    int error;
+    
+    snprintf(host, sizeof(host), "%s", name);
+    snprintf(port, sizeof(port), "%d", defaultPort);
+    sep = strrchr(host, ':');
+    if (sep) { *sep = '\0'; snprintf(port, sizeof(port), "%s", sep + 1); }
+    
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    error = getaddrinfo(host, port, &hints, &result);
+    if (error) return error;
+    
+    memcpy(addr, result->ai_addr, result->ai_addrlen);
+    *addrLen = result->ai_addrlen;
+    freeaddrinfo(result);
+    return 0;
+}
+
+
+int init_MQTT_Client(Mqtt_Client_t* client, char broker[])
+{
+    int error;
+    
+    client->handler.fd = -1;
+    client->handler.callback = poll_MQTT_Client;
+    client->state = MQTT_DISCONNECTED;
+    client->backoff = 1;
+    
+    error = net_Resolve(broker, DEFAULT_MQTT_PORT, &client->addr, &client->addrLen);
+    if (error) { ERROR_MESSAGE("Init: Error resolving MQTT broker '%s': %s", broker, gai_strerror(error)); return -1; }
+    
+    NOTICE_MESSAGE("Init: MQTT publisher for broker '%s' created successfully", broker);
+    return mqtt_Connect(client);
+}
+
+
+/* --- InfluxDB exporter: line protocol of each sample, posted in batches, spilled to a file while the server is down --- */
+void influx_Disconnect(Influx_Client_t* client)
+{
+    if (client->handler.fd >= 0)
+    {
+        epoll_ctl(fd_epoll, EPOLL_CTL_DEL, client->handler.fd, NULL);
+        close(client->handler.fd);
+        client->handler.fd = -1;
+    }
+    client->state = INFLUX_IDLE;
+    client->rxLength = 0;
+}
+
+
+/* the batch stays in the queue and is posted again with exponential backoff */
+void influx_Fail(Influx_Client_t* client, const char reason[])
+{
+    if (client->backoff == 1) { NOTICE_MESSAGE("InfluxDB: Post to '%s' failed: %s, samples are queued", client->host, reason); }
+    else { DEBUG_MESSAGE("InfluxDB: Post to '%s' failed: %s", client->host, reason); }
+    
+    influx_Disconnect(client);
+    client->batchLength = 0;
+    client->retryTime = http_Time() + client->backoff;
+    client->backoff = (client->backoff * 2 > INFLUX_BACKOFF_MAX) ? INFLUX_BACKOFF_MAX : client->backoff * 2;
+}
+
+
+/* lines appended to the spill file, dropped if there is none or it is full */
+void influx_Spill(Influx_Client_t* client, const char data[], int length)
+{
+    if ((client->fd_spill < 0) || (client->spillSize + length > INFLUX_SPILL_MAX) ||
+        (pwrite(client->fd_spill, data, length, client->spillSize) != length))
+    {
+        if (client->dropped == 0) { NOTICE_MESSAGE("InfluxDB: Queue full, samples are dropped"); }
+        client->dropped += length;
+        return;
+    }
+    client->spillSize += length;
+}
+
+
+/* fill the free part of the queue with complete lines of the spill file */
+void influx_Unspill(Influx_Client_t* client)
+{
+    int size = sizeof(client->queue) - client->length;
+    int len;
+    
+    if (client->spillOffset >= client->spillSize) return;
+    if (size >= client->spillSize - client->spillOffset) size = client->spillSize - client->spillOffset;
+    
+    len = pread(client->fd_spill, &client->queue[client->length], size, client->spillOffset);
+    if (len <= 0) { ERROR_MESSAGE("InfluxDB: Error reading spill file '%s': %s", arg_InfluxSpill, strerror(errno)); client->spillOffset = client->spillSize; }
+    while ((len > 0) && (client->queue[client->length + len - 1] != '\n')) len--;
+    client->length += len;
+    client->spillOffset += len;
+    
+    // a line cut off by a crash is dropped
+    if ((len == 0) && (size == client->spillSize - client->spillOffset)) client->spillOffset = client->spillSize;
+    
+    // all spilled lines are queued again, the file starts over
+    if (client->spillOffset >= client->spillSize)
+    {
+        if (ftruncate(client->fd_spill, 0) == -1) { ERROR_MESSAGE("InfluxDB: Error truncating spill file '%s': %s", arg_InfluxSpill, strerror(errno)); }
+        client->spillOffset = 0;
+        client->spillSize = 0;
+        NOTICE_MESSAGE("InfluxDB: Spill file '%s' sent again", arg_InfluxSpill);
+    }
+}
+
+
+/* --- Post all queued lines, the samples of the next interval are queued behind them --- */
+int influx_Post(Influx_Client_t* client)
+{
+    if (client->fd_spill >= 0) influx_Unspill(client);
+    if (client->length == 0) return 0;
+    
+    client->batchLength = client->length;
+    client->headerLength = snprintf(client->header, sizeof(client->header), "POST %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: %s\r\n"
+                                    "Content-Type: text/plain; charset=utf-8\r\nContent-Length: %d\r\nConnection: close\r\n\r\n",
+                                    client->path, client->host, SOLARXD_STRING, client->batchLength);
+    client->txOffset = 0;
+    client->requestTime = http_Time();
+    client->queueTime = client->requestTime;
+    
+    client->handler.fd = socket(client->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (client->handler.fd == -1) { ERROR_MESSAGE("InfluxDB: Error opening socket: %s", strerror(errno)); return -1; }
+    
+    if ((connect(client->handler.fd, (struct sockaddr*)&client->addr, client->addrLen) == -1) && (errno != EINPROGRESS))
+    {
+        influx_Fail(client, strerror(errno));
+        return 0;
+    }
+    
+    client->state = INFLUX_CONNECTING;
+    if (init_Event_Handler(&client->handler, EPOLLOUT) == -1) return -1;
+    return 0;
+}
+
+
+/* --- Write the request without waiting for the server --- */
+void influx_Send(Influx_Client_t* client)
+{
+    struct epoll_event event = {0};
+    struct iovec iov[2];
+    int len;
+    
+    while (client->txOffset < client->headerLength + client->batchLength)
+    {
+        iov[0].iov_base = &client->header[client->txOffset];
+        iov[0].iov_len = (client->txOffset < client->headerLength) ? client->headerLength - client->txOffset : 0;
+        iov[1].iov_base = &client->queue[client->txOffset - client->headerLength + iov[0].iov_len];
+        iov[1].iov_len = client->headerLength + client->batchLength - client->txOffset - iov[0].iov_len;
+        
+        len = sendmsg(client->handler.fd, &(struct msghdr) { .msg_iov = iov, .msg_iovlen = 2 }, MSG_NOSIGNAL);
+        if (len < 0)
+        {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) return;    // EPOLLOUT is still set
+            influx_Fail(client, strerror(errno));
+            return;
+        }
+        client->txOffset += len;
+    }
+    
+    client->state = INFLUX_WAIT_RESPONSE;
+    event.events = EPOLLIN;
+    event.data.ptr = &client->handler;
+    epoll_ctl(fd_epoll, EPOLL_CTL_MOD, client->handler.fd, &event);
+}
+
+
+/* --- Status line of the response received, the connection is closed in any case --- */
+int influx_Done(Influx_Client_t* client, int status)
+{
+    char reason[32];
+    
+    if ((status >= 400) && (status < 500) && (status != 408) && (status != 429))
+    {
+        // rejected data is never accepted, posting it again would stop the export
+        ERROR_MESSAGE("InfluxDB: Post to '%s' rejected with status %d, %d bytes dropped", client->host, status, client->batchLength);
+    }
+    else if ((status < 200) || (status >= 300))
+    {
+        snprintf(reason, sizeof(reason), "status %d", status);
+        influx_Fail(client, reason);
+        return 0;
+    }
+    
+    if (client->backoff > 1) { NOTICE_MESSAGE("InfluxDB: Post to '%s' successful again, %llu bytes dropped", client->host, (unsigned long long)client->dropped); }
+    influx_Disconnect(client);
+    client->dropped = 0;
+    memmove(client->queue, &client->queue[client->batchLength], client->length - client->batchLength);
+    client->length -= client->batchLength;
+    client->batchLength = 0;
+    client->backoff = 1;
+    client->retryTime = 0;
+    
+    // the spilled lines follow right away
+    if ((client->spillOffset < client->spillSize) || (client->length >= INFLUX_BATCH_SIZE)) return influx_Post(client);
+    return 0;
+}
+
+
+int poll_Influx_Client(Event_Handler_t* handler, uint32_t events)
+{
+    Influx_Client_t* client = (Influx_Client_t*)handler;
+    int error = 0, len, status;
+    socklen_t errorLen = sizeof(error);
+    
+    if (client->state == INFLUX_CONNECTING)
+    {
+        getsockopt(handler->fd, SOL_SOCKET, SO_ERROR, &error, &errorLen);
+        if (error)
+        {
+            influx_Fail(client, strerror(error));
+            return 0;
+        }
+        client->state = INFLUX_SENDING;
+    }
+    
+    if (client->state == INFLUX_SENDING)
+    {
+        if (events & (EPOLLHUP | EPOLLERR)) { influx_Fail(client, "connection closed"); return 0; }
+        influx_Send(client);
+        return 0;
+    }
+    
+    if (client->state == INFLUX_WAIT_RESPONSE)
+    {
+        len = read(handler->fd, &client->rxBuffer[client->rxLength], sizeof(client->rxBuffer) - 1 - client->rxLength);
+        if ((len < 0) && ((errno == EAGAIN) || (errno == EINTR))) return 0;
+        if (len <= 0) { influx_Fail(client, "no response"); return 0; }
+        client->rxLength += len;
+        client->rxBuffer[client->rxLength] = '\0';
+        
+        // only the status code is used
+        if ((strchr(client->rxBuffer, '\n') == NULL) && (client->rxLength < (int)sizeof(client->rxBuffer) - 1)) return 0;
+        if (sscanf(client->rxBuffer, "HTTP/%*d.%*d %d", &status) != 1) { influx_Fail(client, "invalid response"); return 0; }
+        return influx_Done(client, status);
+    }
+    return 0;
+}
+
+
+/* --- Line protocol of a valid sample, time of the frame reception in nanoseconds --- */
+void influx_Append(Influx_Client_t* client, const Solax_Inverter_t* inverter, const Solax_LiveData_t* sample, int64_t rxFrameTime)
+{
+    char line[INFLUX_LINE_SIZE];
+    const Solax_Register_t* reg;
+    struct timespec timeNow;
+    int64_t time;
+    int i, len;
+    
+    if (arg_InfluxServer == NULL) return;
+    
+    // monotonic time of the frame moved to the realtime clock
+    clock_gettime(CLOCK_REALTIME, &timeNow);
+    time = (int64_t)timeNow.tv_sec * 1000000000 + timeNow.tv_nsec - (timing_Now() - rxFrameTime);
+    
+    len = sprintf(line, "%s,address=%d ", INFLUX_MEASUREMENT, inverter->Address);
+    for (i = 0; i < REGISTER_COUNT; i++)
+    {
+        reg = &solax_Registers[i];
+        if (reg->bits) len += sprintf(&line[len], "%s%s=%ui", i ? "," : "", reg->name, LIVE_DATA_BITS(sample, reg->field));
+        else len += sprintf(&line[len], "%s%s=%.*f", i ? "," : "", reg->name, reg->precision, LIVE_DATA_FLOAT(sample, reg->field));
+    }
+    len += sprintf(&line[len], " %lld\n", (long long)time);
+    
+    // no room: the lines not posted yet go to the spill file
+    if (client->length + len > (int)sizeof(client->queue))
+    {
+        if ((client->fd_spill >= 0) && (client->spillOffset == client->spillSize)) { NOTICE_MESSAGE("InfluxDB: Queue full, samples are spilled to '%s'", arg_InfluxSpill); }
+        influx_Spill(client, &client->queue[client->batchLength], client->length - client->batchLength);
+        client->length = client->batchLength;
+    }
+    if (client->length == 0) client->queueTime = http_Time();
+    memcpy(&client->queue[client->length], line, len);
+    client->length += len;
+    
+    if ((client->state == INFLUX_IDLE) && (client->length >= INFLUX_BATCH_SIZE) && (http_Time() >= client->retryTime)) influx_Post(client);
+}
+
+
+/* --- Flush interval, retry and request timeout, called once per query interval --- */
+int influx_Timer(Influx_Client_t* client)
+{
+    time_t now = http_Time();
+    
+    if (arg_InfluxServer == NULL) return 0;
+    
+    if ((client->state != INFLUX_IDLE) && (now - client->requestTime >= INFLUX_TIMEOUT))
+    {
+        influx_Fail(client, "timeout");
+        return 0;
+    }
+    if ((client->state == INFLUX_IDLE) && (now >= client->retryTime) &&
+        (((client->length) && (now - client->queueTime >= INFLUX_FLUSH_INTERVAL)) || (client->length >= INFLUX_BATCH_SIZE) || (client->spillOffset < client->spillSize)))
+    {
+        return influx_Post(client);
+    }
+    return 0;
+}
+
+
+/* --- The queued lines are kept in the spill file at exit --- */
+void influx_Stop(Influx_Client_t* client)
+{
+    if (client->length == 0) return;
+    DEBUG_MESSAGE("InfluxDB: %d queued bytes kept in the spill file", client->length);
+    influx_Spill(client, client->queue, client->length);
+    client->length = 0;
+}
+
+
+/* "host[:port][/path]" */
+int init_Influx_Client(Influx_Client_t* client, const char server[], const char spill[])
+{
+    struct stat info;
+    char* path;
+    int error;
+    
+    client->handler.fd = -1;
+    client->handler.callback = poll_Influx_Client;
+    client->state = INFLUX_IDLE;
+    client->backoff = 1;
+    client->fd_spill = -1;
+    
+    snprintf(client->host, sizeof(client->host), "%s", server);
+    snprintf(client->path, sizeof(client->path), "%s", DEFAULT_INFLUX_PATH);
+    path = strchr(client->host, '/');
+    if (path)
+    {
+        snprintf(client->path, sizeof(client->path), "%s", path);
+        *path = '\0';
+    }
+    
+    error = net_Resolve(client->host, DEFAULT_INFLUX_PORT, &client->addr, &client->addrLen);
+    if (error) { ERROR_MESSAGE("Init: Error resolving InfluxDB server '%s': %s", client->host, gai_strerror(error)); return -1; }
+    
+    if (spill != NULL)
+    {
+        client->fd_spill = open(spill, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (client->fd_spill == -1) { ERROR_MESSAGE("Init: Error opening spill file '%s': %s", spill, strerror(errno)); return -1; }
+        if (fstat(client->fd_spill, &info) == 0) client->spillSize = info.st_size;    // lines of the last run are posted first
+    }
+    
+    NOTICE_MESSAGE("Init: InfluxDB exporter for '%s%s' created successfully, %lld bytes spilled", client->host, client->path, (long long)client->spillSize);
+    return 0;
+}
+
+
+/* --- Shared memory: the snapshot for local readers, with the same seqlock as for the HTTP threads --- */
+int shm_Open(Shm_t* shm, const char name[])
+{
+    Shm_Header_t* header;
+    int fd, i;
+    
+    fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) { ERROR_MESSAGE("Init: Error opening shared memory '%s': %s", name, strerror(errno)); return -1; }
+    if (ftruncate(fd, sizeof(Shm_Segment_t)) == -1)
+    {
+        ERROR_MESSAGE("Init: Error sizing shared memory '%s': %s", name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    shm->segment = mmap(NULL, sizeof(Shm_Segment_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm->segment == MAP_FAILED)
+    {
+        shm->segment = NULL;
+        ERROR_MESSAGE("Init: Error mapping shared memory '%s': %s", name, strerror(errno));
+        return -1;
+    }
+    
+    // readers of a previous run see the segment change, the sequence is continued
+    header = &shm->segment->header;
+    __atomic_store_n(&header->sequence, (header->sequence + 1) | 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(header->magic, "SOLAXSHM", 8);
+    header->version = SHM_VERSION;
+    header->generation = 0;
+    header->inverterCount = 0;
+    header->fieldCount = REGISTER_COUNT;
+    header->recordSize = sizeof(Shm_Inverter_t);
+    header->fieldsOffset = offsetof(Shm_Segment_t, fields);
+    header->recordsOffset = offsetof(Shm_Segment_t, inverters);
+    header->time = 0;
+    for (i = 0; i < REGISTER_COUNT; i++)
+    {
+        snprintf(shm->segment->fields[i], SHM_NAME_SIZE, "%s", solax_Registers[i].name);
+    }
+    __atomic_store_n(&header->sequence, header->sequence + 1, __ATOMIC_RELEASE);
+    
+    // no subscribers, also without notify socket
+    for (i = 0; i < SHM_MAX_SUBSCRIBERS; i++)
+    {
+        shm->subscribers[i] = -1;
+    }
+    
+    NOTICE_MESSAGE("Init: Shared memory '%s' created successfully, %d bytes", name, (int)sizeof(Shm_Segment_t));
+    return 0;
+}
+
+
+/* --- Subscribers get one packet of sequence and generation per update --- */
+int shm_Notify_Open(Shm_t* shm, const char path[])
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    
+    if (strlen(path) >= sizeof(addr.sun_path)) { ERROR_MESSAGE("Init: Notify socket path '%s' too long", path); return -1; }
+    strcpy(addr.sun_path, path);
+    
+    shm->handler.fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (shm->handler.fd == -1) { ERROR_MESSAGE("Init: Error opening notify socket: %s", strerror(errno)); return -1; }
+    
+    unlink(path);
+    if ((bind(shm->handler.fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) || (listen(shm->handler.fd, SHM_MAX_SUBSCRIBERS) == -1))
+    {
+        ERROR_MESSAGE("Init: Error binding notify socket '%s': %s", path, strerror(errno));
+        return -1;
+    }
+    
+    NOTICE_MESSAGE("Init: Notify socket '%s' created successfully", path);
+    return 0;
+}
+
+
+int poll_Shm_Notify(Event_Handler_t* handler, uint32_t events)
+{
+    Shm_t* shm = (Shm_t*)handler;
+    int fd, i;
+    (void)events;
+    
+    while ((fd = accept4(handler->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+    {
+        for (i = 0; (i < SHM_MAX_SUBSCRIBERS) && (shm->subscribers[i] >= 0); i++);
+        if (i == SHM_MAX_SUBSCRIBERS)
+        {
+            NOTICE_MESSAGE("Shm: Too many subscribers, maximum is %d", SHM_MAX_SUBSCRIBERS);
+            close(fd);
+            continue;
+        }
+        DEBUG_MESSAGE("Shm: Subscriber %d connected", fd);
+        shm->subscribers[i] = fd;
+    }
+    return 0;
+}
+
+
+void shm_Publish(Shm_t* shm, const Solax_Snapshot_t* snapshot)
+{
+    Shm_Header_t* header = &shm->segment->header;
+    Shm_Inverter_t* record;
+    const Solax_Snapshot_Inverter_t* inverter;
+    struct timespec timeNow;
+    uint32_t message[2];
+    int i, j;
+    
+    clock_gettime(CLOCK_REALTIME, &timeNow);
+    
+    __atomic_store_n(&header->sequence, header->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    
+    header->generation = snapshot->generation;
+    header->inverterCount = snapshot->inverterCount;
+    header->time = (int64_t)timeNow.tv_sec * 1000 + timeNow.tv_nsec / 1000000;
+    for (i = 0; i < snapshot->inverterCount; i++)
+    {
+        inverter = &snapshot->inverters[i];
+        record = &shm->segment->inverters[i];
+        record->address = inverter->Address;
+        record->online = inverter->Online;
+        record->valid = inverter->Valid;
+        record->sampleValid = inverter->Sample.valid;
+        record->qualityOfService = inverter->QualityOfService;
+        record->sampleCount = inverter->SampleCount;
+        for (j = 0; j < REGISTER_COUNT; j++)
+        {
+            record->liveData[j] = solax_Register_Value(&inverter->LiveData, &solax_Registers[j]);
+            record->sample[j] = solax_Register_Value(&inverter->Sample, &solax_Registers[j]);
+        }
+    }
+    
+    __atomic_store_n(&header->sequence, header->sequence + 1, __ATOMIC_RELEASE);
+    
+    // a subscriber that does not read misses packets, a closed one leaves
+    message[0] = header->sequence;
+    message[1] = header->generation;
+    if (shm->handler.fd < 0) return;
+    for (i = 0; i < SHM_MAX_SUBSCRIBERS; i++)
+    {
+        if (shm->subscribers[i] < 0) continue;
+        if ((send(shm->subscribers[i], message, sizeof(message), MSG_DONTWAIT | MSG_NOSIGNAL) == -1) && (errno != EAGAIN))
+        {
+            DEBUG_MESSAGE("Shm: Subscriber %d left", shm->subscribers[i]);
+            close(shm->subscribers[i]);
+            shm->subscribers[i] = -1;
+        }
+    }
+}
+
+
+/* --- Publish the state of all inverters, the HTTP threads copy it without blocking the serial thread --- */
+void solax_Snapshot_Publish(void)
+{
+    Solax_Snapshot_t* snapshot = &solax_Snapshot;
+    Solax_Snapshot_Inverter_t* published;
+    const Solax_Inverter_t* inverter;
+    uint64_t notify = 1;
+    int i;
+    
+    // seqlock, the sequence is odd while the snapshot is written
+    __atomic_store_n(&snapshot->sequence, snapshot->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    
+    snapshot->generation = solax_SampleGeneration;
+    snapshot->inverterCount = solax_InverterCount;
+    snapshot->metrics = metrics_Data;
+    for (i = 0; i < solax_InverterCount; i++)
+    {
+        inverter = &solax_Inverters[i];
+        published = &snapshot->inverters[i];
+        published->Address = inverter->Address;
+        published->Online = inverter->Online;
+        published->Valid = (inverter->Window.countValid > 0);
+        published->QualityOfService = inverter->QualityOfService;
+        published->StateQuery = inverter->StateQuery;
+        published->SampleCount = inverter->SampleCount;
+        published->LiveData = inverter->LiveData;
+        if (inverter->SampleCount) solax_Sample_Load(&inverter->Samples, inverter->SampleCount - 1, &published->Sample);
+        published->Counters = inverter->Counters;
+    }
+    
+    __atomic_store_n(&snapshot->sequence, snapshot->sequence + 1, __ATOMIC_RELEASE);
+    
+    if (shm_Data.segment != NULL) shm_Publish(&shm_Data, snapshot);
+    for (i = 0; i < http_WorkerCount; i++)
+    {
+        if (write(http_Workers[i].notify.fd, &notify, sizeof(notify)) == -1) { TRACE_MESSAGE("HTTP: Notify of thread %d failed: %s", i, strerror(errno)); }
+    }
+}
+
+
+/* --- Handle the response of the pending query and store it as next sample --- */
+int solax_LiveData_Update(Solax_Bus_t* bus, bool timeout)
+{
+    Solax_Inverter_t* inverter = bus->queryInverter;
+    Solax_RawData_t rawData;
+    Solax_LiveData_t sample;
+    int error;
+    
+    error = solax_QueryHandle(inverter, &rawData, timeout);
+    if (error == -1) return -1;
+    if (error == ERR_INCOMPLETE) return 0;
+    
+    solax_LiveData_Average(inverter, &rawData);
+    
+    if (rawData.valid)
+    {
+        solax_Sample_Load(&inverter->Samples, inverter->SampleCount - 1, &sample);
+        history_Append(&history_File, inverter, &sample);
+        rollup_Add(&solax_Rollups[inverter - solax_Inverters], &sample);
+        influx_Append(&influx_Client, inverter, &sample, bus->timing.rxFrameTime);
+    }
+    
+    DEBUG_MESSAGE("Sample: Inverter %d, Online %d, QoS %.2f, Power %.0f W", inverter->Address, inverter->Online, inverter->QualityOfService, inverter->LiveData.Power);
+    
+    solax_SampleGeneration++;
+    solax_Snapshot_Publish();
+    mqtt_Publish_Inverter(&mqtt_Client, &solax_Snapshot.inverters[inverter - solax_Inverters]);
+    return 0;
+}
+
+
+/* --- Scheduler: the queries of all inverters of a bus are sent back-to-back in each query interval, the buses in parallel --- */
+int solax_RetryTimeout(const Solax_Bus_t* bus)
+{
+    int timeout_ms = RECONNECT_TIMEOUT;
+    
+    // reconnection and adaptive mode: a multiple of the measured response time
+    if (bus->latencyAverage > 0)
+    {
+        timeout_ms = bus->latencyAverage * ADAPTIVE_TIMEOUT_FACTOR;
+        if (timeout_ms < ADAPTIVE_TIMEOUT_MIN) timeout_ms = ADAPTIVE_TIMEOUT_MIN;
+        if (timeout_ms > ADAPTIVE_TIMEOUT_MAX) timeout_ms = ADAPTIVE_TIMEOUT_MAX;
+    }
+    return timeout_ms;
+}
+
+
+int solax_ResponseTimeout(const Solax_Bus_t* bus)
+{
+    if (arg_Adaptive && (bus->latencyAverage > 0)) return solax_RetryTimeout(bus);
+    return (arg_QueryInterval * RESPONSE_TIMEOUT_SHARE / 100) / bus->inverterCount;
+}
+
+
+/* --- Adaptive: the next round starts one query interval after the start of this round, or at once if it took longer --- */
+int solax_QueryRound_End(Solax_Bus_t* bus)
+{
+    int64_t now = timing_Now() / 1000000;
+    int64_t delay = arg_QueryInterval;
+    int64_t timeValid = bus->timeStart;
+    int i;
+    
+    if (!arg_Adaptive) return 0;
+    
+    // slow poll when no live data was received for the online timeout, e.g. at night
+    for (i = 0; i < bus->inverterCount; i++)
+    {
+        if (bus->inverters[i]->TimeValid > timeValid) timeValid = bus->inverters[i]->TimeValid;
+    }
+    if (now - timeValid >= TIMEOUT_INVERTER_ONLINE_MS) delay = ADAPTIVE_OFFLINE_INTERVAL;
+    
+    delay -= now - bus->roundStart;
+    if (delay < 1) delay = 1;
+    return timer_Set(bus->timerQuery.fd, delay, 0);
+}
+
+
+int solax_QueryRound_Next(Solax_Bus_t* bus)
+{
+    Solax_Inverter_t* inverter = bus->queryInverter;
+    int64_t now = timing_Now() / 1000000;
+    
+    // the next step of a reconnection is queried at once
+    if ((inverter != NULL) && inverter->QueryAgain && (inverter->RoundQueries < RECONNECT_QUERIES))
+    {
+        inverter->QueryAgain = false;
+        inverter->RoundQueries++;
+        if (solax_QueryStart(inverter) == -1) return -1;
+        return timer_Set(bus->timerResponse.fd, solax_RetryTimeout(bus), 0);
+    }
+    
+    // inverters waiting for the next attempt are skipped
+    while ((bus->queryNext < bus->inverterCount) && (bus->inverters[bus->queryNext]->TimeRetry > now)) bus->queryNext++;
+    if (bus->queryNext >= bus->inverterCount) return solax_QueryRound_End(bus);   // round completed
+    
+    inverter = bus->inverters[bus->queryNext++];
+    inverter->QueryAgain = false;
+    inverter->RoundQueries = 1;
+    if (solax_QueryStart(inverter) == -1) return -1;
+    
+    return timer_Set(bus->timerResponse.fd, inverter->Online ? solax_ResponseTimeout(bus) : solax_RetryTimeout(bus), 0);
+}
+
+
+int solax_QueryRound_Start(Solax_Bus_t* bus)
+{
+    int64_t now = timing_Now() / 1000000;
+    
+    if (bus->roundStart) bus->roundPeriod = now - bus->roundStart;
+    else bus->timeStart = now;
+    bus->roundStart = now;
+    
+    bus->queryNext = 0;
+    bus->queryInverter = NULL;
+    return solax_QueryRound_Next(bus);
+}
+
+
+Solax_Inverter_t* solax_Inverter_Find(uint8_t address)
+{
+    int i;
+    
+    for (i = 0; i < solax_InverterCount; i++)
+    {
+        if (solax_Inverters[i].Address == address) return &solax_Inverters[i];
+    }
+    return NULL;
+}
+
+
+Solax_Inverter_t* solax_Inverter_Add(Solax_Bus_t* bus, uint8_t address)
+{
+    Solax_Inverter_t* inverter;
+    
+    if (solax_InverterCount >= MAX_INVERTERS) return NULL;
+    
+    inverter = &solax_Inverters[solax_InverterCount++];
+    *inverter = (Solax_Inverter_t) {0};
+    inverter->Address = address;
+    inverter->StateQuery = STATE_QUERY_LIVE_DATA;
+    inverter->Bus = bus;
+    bus->inverters[bus->inverterCount++] = inverter;
+    return inverter;
+}
+
+
+/* --- Warm start: registration, samples and averages of the inverters survive a restart --- */
+static State_Sample_t state_Samples[SAMPLE_BUFFER_COUNT];    // of one inverter, used by the serial thread only
+
+int state_Write_Inverter(FILE* fp, const Solax_Inverter_t* inverter, int64_t now)
+{
+    State_Inverter_t record = {0};
+    uint32_t number = inverter->Window.oldestQoS;
+    int i, n;
+    
+    record.address = inverter->Address;
+    memcpy(record.serialNumber, inverter->SerialNumber, sizeof(record.serialNumber));
+    record.stateQuery = inverter->StateQuery;
+    record.online = inverter->Online;
+    record.sampleCount = inverter->SampleCount - number;
+    record.qualityOfService = inverter->QualityOfService;
+    record.timeValid = inverter->TimeValid;
+    
+    // the QoS interval covers the average window, invalid samples are kept for the QoS
+    for (n = 0; n < record.sampleCount; n++, number++)
+    {
+        state_Samples[n] = (State_Sample_t) { .age = now - solax_Sample_Time(&inverter->Samples, number), .valid = inverter->Samples.valid[number % SAMPLE_BUFFER_COUNT] };
+        for (i = 0; i < REGISTER_COUNT; i++) state_Samples[n].raw[i] = solax_Sample_Raw(&inverter->Samples, &solax_Registers[i], number);
+    }
+    
+    if (fwrite(&record, sizeof(record), 1, fp) != 1) return -1;
+    if (fwrite(state_Samples, sizeof(State_Sample_t), record.sampleCount, fp) != record.sampleCount) return -1;
+    return 0;
+}
+
+
+int state_Save(const char path[])
+{
+    State_Header_t header = { .magic = "SOLAXSTA", .version = STATE_VERSION, .registerCount = REGISTER_COUNT, .count = solax_InverterCount };
+    struct timespec timeNow;
+    char temp[1024];
+    bool failed;
+    FILE* fp;
+    int i;
+    
+    // written to a temporary file first, a crash never leaves a partial state file
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    fp = fopen(temp, "w");
+    if (fp == NULL) { ERROR_MESSAGE("State: Error opening '%s': %s", temp, strerror(errno)); return -1; }
+    
+    clock_gettime(CLOCK_REALTIME, &timeNow);
+    header.realTime = (int64_t)timeNow.tv_sec * 1000000000 + timeNow.tv_nsec;
+    header.monotonicTime = timing_Now();
+    failed = (fwrite(&header, sizeof(header), 1, fp) != 1);
+    for (i = 0; (i < solax_InverterCount) && !failed; i++)
+    {
+        failed = (state_Write_Inverter(fp, &solax_Inverters[i], header.monotonicTime / 1000000) == -1);
+    }
+    if ((fclose(fp) != 0) || failed || (rename(temp, path) == -1))
+    {
+        ERROR_MESSAGE("State: Error writing '%s': %s", path, strerror(errno));
+        unlink(temp);
+        return -1;
+    }
+    
+    DEBUG_MESSAGE("State: Saved to '%s'", path);
+    return 0;
+}
+
+
+/* the saved samples are stored into the ring again and the window is rebuilt for the current average interval */
+void state_Restore_Samples(Solax_Inverter_t* inverter, int count, int64_t saveTime)
+{
+    Solax_RawData_t rawData;
+    int n;
+    
+    inverter->SampleCount = 0;
+    inverter->Window.oldestQoS = 0;
+    inverter->Window.countQoS = 0;
+    for (n = 0; n < count; n++)
+    {
+        rawData.valid = state_Samples[n].valid;
+        memcpy(rawData.raw, state_Samples[n].raw, sizeof(rawData.raw));
+        solax_Sample_Store(&inverter->Samples, inverter->SampleCount++, &rawData, saveTime - state_Samples[n].age);
+        inverter->Window.countQoS += rawData.valid;
+    }
+    solax_Window_Resize(inverter, inverter->Window.length);
+}
+
+
+/* inverters are matched by address, the monotonic times are moved to the clock of this run */
+int state_Load(const char path[])
+{
+    State_Inverter_t record;
+    State_Header_t header;
+    struct timespec timeNow;
+    Solax_Inverter_t* inverter;
+    int64_t realTime, shift;
+    uint32_t i;
+    int restored = 0;
+    FILE* fp;
+    
+    state_LastSave = http_Time();
+    
+    fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        NOTICE_MESSAGE("Init: No state file '%s', cold start", path);
+        return 0;
+    }
+    if ((fread(&header, sizeof(header), 1, fp) != 1) || (memcmp(header.magic, "SOLAXSTA", 8) != 0) ||
+        (header.version != STATE_VERSION) || (header.registerCount != REGISTER_COUNT))
+    {
+        NOTICE_MESSAGE("Init: State file '%s' not usable, cold start", path);
+        fclose(fp);
+        return 0;
+    }
+    
+    clock_gettime(CLOCK_REALTIME, &timeNow);
+    realTime = (int64_t)timeNow.tv_sec * 1000000000 + timeNow.tv_nsec;
+    shift = ((timing_Now() - realTime) - (header.monotonicTime - header.realTime)) / 1000000;
+    
+    for (i = 0; (i < header.count) && (fread(&record, sizeof(record), 1, fp) == 1); i++)
+    {
+        if ((record.sampleCount > SAMPLE_BUFFER_COUNT) ||
+            (fread(state_Samples, sizeof(State_Sample_t), record.sampleCount, fp) != record.sampleCount)) break;
+        
+        inverter = solax_Inverter_Find(record.address);
+        if (inverter == NULL) continue;    // not configured anymore
+        
+        // the known serial number saves the broadcast
+        memcpy(inverter->SerialNumber, record.serialNumber, sizeof(inverter->SerialNumber));
+        inverter->SerialNumber[sizeof(inverter->SerialNumber) - 1] = '\0';
+        inverter->StateQuery = record.stateQuery;
+        
+        // samples older than the QoS interval are not used
+        if ((realTime - header.realTime) / 1000000 > QUALITY_OF_SERVICE_INTERVAL_MS) continue;
+        
+        inverter->Online = record.online;
+        inverter->QualityOfService = record.qualityOfService;
+        inverter->TimeValid = record.timeValid + shift;
+        state_Restore_Samples(inverter, record.sampleCount, header.monotonicTime / 1000000 + shift);
+        restored++;
+    }
+    fclose(fp);
+    
+    NOTICE_MESSAGE("Init: State file '%s' of %lld s ago loaded, samples of %d inverter(s) restored", path,
+                   (long long)((realTime - header.realTime) / 1000000000), restored);
+    return 0;
+}
+
+
+/* --- Called once per query interval --- */
+void state_Timer(void)
+{
+    time_t now = http_Time();
+    
+    if (arg_StateFile == NULL) return;
+    if (now - state_LastSave < STATE_SYNC_INTERVAL) return;
+    
+    state_LastSave = now;
+    state_Save(arg_StateFile);
+}
+
+
+int poll_Serial_Interface(Event_Handler_t* handler, uint32_t events)
+{
+    Solax_Bus_t* bus = (Solax_Bus_t*)handler;
+    uint8_t buff[sizeof(Solax_Message_t)];
+    int error = 0;
+    socklen_t errorLen = sizeof(error);
+    
+    if (handler->fd < 0) return 0;    // closed by an earlier event of the same epoll_wait()
+    
+    if (bus->queryPending)
+    {
+        if (solax_LiveData_Update(bus, false) == -1) return -1;
+        
+        // response completed, continue with the next inverter
+        if (!bus->queryPending && (solax_QueryRound_Next(bus) == -1)) return -1;
+    }
+    else if ((read(handler->fd, buff, sizeof(buff)) < 0) && (errno != EAGAIN))
+    {
+        // no query pending, discard unexpected data
+        return solax_Transport_Error(bus, "ComRx: Error receiving data from");
+    }
+    
+    // network transport: connection closed by the gateway or failed
+    if ((events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) && (handler->fd >= 0) && (bus->transport->error != NULL))
+    {
+        getsockopt(handler->fd, SOL_SOCKET, SO_ERROR, &error, &errorLen);
+        errno = error ? error : ECONNRESET;
+        return bus->transport->error(bus, "ComRx: Connection lost to");
+    }
+    return 0;
+}
+
+
+int poll_Query_Timer(Event_Handler_t* handler, uint32_t events)
+{
+    Solax_Bus_t* bus = CONTAINER_OF(handler, Solax_Bus_t, timerQuery);
+    uint64_t expirations;
+    (void)events;
+    
+    if (read(handler->fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return 0;
+    
+    // a response not received until now is timed out
+    if (bus->queryPending)
+    {
+        if (solax_LiveData_Update(bus, true) == -1) return -1;
+    }
+    
+    // called for each bus, all check the time of their last run
+    history_Timer(&history_File);
+    state_Timer();
+    if (fp_capture_file != NULL) fflush(fp_capture_file);
+    if (mqtt_Timer(&mqtt_Client) == -1) return -1;
+    if (influx_Timer(&influx_Client) == -1) return -1;
+    
+    return solax_QueryRound_Start(bus);
+}
+
+
+int poll_Response_Timer(Event_Handler_t* handler, uint32_t events)
+{
+    Solax_Bus_t* bus = CONTAINER_OF(handler, Solax_Bus_t, timerResponse);
+    uint64_t expirations;
+    (void)events;
+    
+    if (read(handler->fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return 0;
+    
+    if (bus->queryPending)
+    {
+        if (solax_LiveData_Update(bus, true) == -1) return -1;
+    }
+    
+    return solax_QueryRound_Next(bus);
+}
+
+
+
+/* --- A new bus for each -d, the inverters given by -a are added to the last bus --- */
+Solax_Bus_t* solax_Bus_Add(const char device[])
+{
+    Solax_Bus_t* bus;
+    
+    // inverters given before the first device
+    if ((solax_BusCount > 0) && (solax_Buses[solax_BusCount - 1].device == NULL))
+    {
+        solax_Buses[solax_BusCount - 1].device = device;
+        return &solax_Buses[solax_BusCount - 1];
+    }
+    if (solax_BusCount >= MAX_BUSES) return NULL;
+    
+    bus = &solax_Buses[solax_BusCount];
+    *bus = (Solax_Bus_t) {0};
+    bus->handler = (Event_Handler_t) { -1, poll_Serial_Interface };
+    bus->timerQuery = (Event_Handler_t) { -1, poll_Query_Timer };
+    bus->timerResponse = (Event_Handler_t) { -1, poll_Response_Timer };
+    bus->index = solax_BusCount++;
+    bus->device = device;
+    return bus;
+}
+
+/* --- SIGHUP: -s, -L and -l of the config file are applied, the serial interfaces and the inverter states are kept --- */
+// next word of a shell assignment like "-l '/var/log/solax d.log'", with the quotes and backslashes removed in place
+char* config_Word(char** text)
+{
+    char* in = *text;
+    char* out;
+    char* word;
+    char quote = '\0';
+    
+    while (isspace((unsigned char)*in)) in++;
+    if ((*in == '\0') || (*in == '#')) return NULL;
+    
+    word = out = in;
+    while ((*in != '\0') && ((quote != '\0') || !isspace((unsigned char)*in)))
+    {
+        if ((quote != '\0') && (*in == quote))
+        {
+            quote = '\0';
+            in++;
+        }
+        else if ((quote == '\0') && ((*in == '"') || (*in == '\'')))
+        {
+            quote = *in++;
+        }
+        else if ((*in == '\\') && (in[1] != '\0') && ((quote == '\0') || ((quote == '"') && (strchr("\"\\$`", in[1]) != NULL))))
+        {
+            in++;
+            *out++ = *in++;
+        }
+        else
+        {
+            *out++ = *in++;
+        }
+    }
+    *text = (*in != '\0') ? in + 1 : in;
+    *out = '\0';
+    return word;
+}
+
+
+int config_Reload(const char path[])
+{
+    static char options[1024];              // the strings of argv
+    static char logFile[1024];
+    char line[sizeof(options)];
+    char* argv[64] = { SOLARXD_STRING };
+    char* value;
+    char* cursor;
+    int argc = 1;
+    int opt, i;
+    int avSamples = arg_StartAV_Samples;    // options not given keep their value of the command line
+    int logLevel = arg_StartLogLevel;
+    char* logPath = arg_StartLogFile;
+    FILE* fp;
+    
+    fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        NOTICE_MESSAGE("Main: No config file '%s', Log-File opened again", path);
+        return log_Reopen(arg_LogFile);
+    }
+    
+    // SOLAXD_OPTS="...", the last assignment counts like in the shell
+    options[0] = '\0';
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        for (value = line; isspace((unsigned char)*value); value++);
+        if (strncmp(value, "SOLAXD_OPTS=", 12) == 0) snprintf(options, sizeof(options), "%s", value + 12);
+    }
+    fclose(fp);
+    
+    // the value of the assignment first, then its words like systemd splits $SOLAXD_OPTS
+    options[strcspn(options, "\r\n")] = '\0';
+    cursor = options;
+    value = config_Word(&cursor);
+    cursor = (value != NULL) ? value : "";
+    while ((argc < 63) && ((value = config_Word(&cursor)) != NULL))
+    {
+        argv[argc++] = value;
+    }
+    argv[argc] = NULL;
+    
+    optind = 0;    // restart of getopt()
+    while ((opt = getopt(argc, argv, arg_Options)) != -1)
+    {
+        switch (opt)
+        {
+            case 's':
+                avSamples = atoi(optarg);
+                break;
+            case 'L':
+                logLevel = atoi(optarg);
+                break;
+            case 'l':
+                logPath = optarg;
+                break;
+            default:
+                break;    // all other options need a restart
         }
     }
+    if ((avSamples < 1) || (avSamples > MAX_AVERAGE_INTERVAL))
+    {
+        ERROR_MESSAGE("Main: Average interval %d of '%s' not in range 1..%d seconds, kept %d", avSamples, path, MAX_AVERAGE_INTERVAL, arg_AV_Samples);
+        avSamples = arg_AV_Samples;
+    }
     
-    if (solax_InverterOnline == true)
+    if (logPath != NULL)
     {
-        timeoutInverterOnline++;
-        if (timeoutInverterOnline >= TIMEOUT_INVERTER_ONLINE)
-        {
-            solax_InverterOnline = false;
-            NOTICE_MESSAGE("Solax: Inverter offline");
-        }
+        snprintf(logFile, sizeof(logFile), "%s", logPath);
+        logPath = logFile;
     }
-    else  // (solax_InverterOnline == false)
+    if (log_Reopen(logPath) == 0) arg_LogFile = logPath;
+    arg_LogLevel = logLevel;
+    
+    if (avSamples != arg_AV_Samples)
     {
-        if (timeoutInverterOnline == 0)
+        arg_AV_Samples = avSamples;
+        for (i = 0; i < solax_InverterCount; i++)
         {
-            solax_InverterOnline = true;
-            NOTICE_MESSAGE("Solax: Live data received");
+            solax_Window_Resize(&solax_Inverters[i], arg_AV_Samples * 1000);
         }
+        solax_SampleGeneration++;
+        solax_Snapshot_Publish();
     }
-
-    
-    errorTx = solax_SendQuery(stateQuery);
-    if (errorTx == -1) return -1;
     
-    return errorRx;
+    NOTICE_MESSAGE("Main: Config '%s' reloaded, AV_Samples: %d, LogLevel: %d, LogFile: %s", path, arg_AV_Samples, arg_LogLevel, arg_LogFile);
+    return 0;
 }
 
 
-
-void solax_LiveData_Average(const Solax_LiveData_t* liveData, uint8_t idx, uint8_t max_idx)
+int poll_Signal(Event_Handler_t* handler, uint32_t events)
 {
-    uint8_t i, cnt = 0, qos = 0;
-
-    solax_LiveData = (Solax_LiveData_t) {0};
-
-    for (i = 0; i <= arg_AV_Samples; i++)
+    struct signalfd_siginfo info;
+    (void)events;
+    
+    while (read(handler->fd, &info, sizeof(info)) == sizeof(info))
     {
-        if (liveData[idx].valid != true) continue;
-        solax_LiveData.Temperature  += liveData[idx].Temperature;
-        solax_LiveData.DC1_Voltage  += liveData[idx].DC1_Voltage;
-        solax_LiveData.DC2_Voltage  += liveData[idx].DC2_Voltage;
-        solax_LiveData.DC1_Current  += liveData[idx].DC1_Current;
-        solax_LiveData.DC2_Current  += liveData[idx].DC2_Current;
-        solax_LiveData.AC_Current   += liveData[idx].AC_Current;
-        solax_LiveData.AC_Voltage   += liveData[idx].AC_Voltage;
-        solax_LiveData.Frequency    += liveData[idx].Frequency;
-        solax_LiveData.Power        += liveData[idx].Power;
-        solax_LiveData.ErrorBits    |= liveData[idx].ErrorBits;
-        if (solax_LiveData.Energy_Today  < liveData[idx].Energy_Today ) solax_LiveData.Energy_Today  = liveData[idx].Energy_Today;
-        if (solax_LiveData.Energy_Total  < liveData[idx].Energy_Total ) solax_LiveData.Energy_Total  = liveData[idx].Energy_Total;
-        if (solax_LiveData.Runtime_Total < liveData[idx].Runtime_Total) solax_LiveData.Runtime_Total = liveData[idx].Runtime_Total;
-        if (solax_LiveData.Status        < liveData[idx].Status       ) solax_LiveData.Status        = liveData[idx].Status;
-        
-        if (idx)
+        if (info.ssi_signo == SIGUSR1) timing_Dump();
+        if (info.ssi_signo == SIGHUP) config_Reload(arg_ConfigFile);
+        if ((info.ssi_signo == SIGTERM) || (info.ssi_signo == SIGINT))
         {
-            idx--;
+            // regular exit, the pending log lines are written by log_Stop()
+            if (history_File.header != NULL) history_Sync(&history_File);
+            if (fp_capture_file != NULL) fflush(fp_capture_file);
+            if (arg_StateFile != NULL) state_Save(arg_StateFile);
+            if (arg_InfluxServer != NULL) influx_Stop(&influx_Client);
+            NOTICE_MESSAGE("Main: %s stopped", SOLARXD_STRING);
+            errno = 0;
+            return -1;
         }
-        else
-        {
-            idx = max_idx;
-        }
-        cnt++;
-    }
-    
-    if (cnt)
-    {
-        solax_LiveData.Temperature /= cnt;
-        solax_LiveData.DC1_Voltage /= cnt;
-        solax_LiveData.DC2_Voltage /= cnt;
-        solax_LiveData.DC1_Current /= cnt;
-        solax_LiveData.DC2_Current /= cnt;
-        solax_LiveData.AC_Current  /= cnt;
-        solax_LiveData.AC_Voltage  /= cnt;
-        solax_LiveData.Frequency   /= cnt;
-        solax_LiveData.Power       /= cnt;
-    }
-    
-
-    for (idx = 0; idx <= max_idx; idx++)
-    {
-        qos += liveData[idx].valid;
     }
-    
-    solax_QualityOfService = (float)qos / (max_idx + 1);
-    
-    /*
-    INFO_MESSAGE("TEST: solax_LiveData.QualityOfService: %.2f", solax_QualityOfService);
-    INFO_MESSAGE("TEST: solax_LiveData.Temperature: %.0f C",    solax_LiveData.Temperature);
-    INFO_MESSAGE("TEST: solax_LiveData.DC1_Voltage: %.1f V",    solax_LiveData.DC1_Voltage);
-    INFO_MESSAGE("TEST: solax_LiveData.DC2_Voltage: %.1f V",    solax_LiveData.DC2_Voltage);
-    INFO_MESSAGE("TEST: solax_LiveData.DC1_Current: %.1f A",    solax_LiveData.DC1_Current);
-    INFO_MESSAGE("TEST: solax_LiveData.DC2_Current: %.1f A",    solax_LiveData.DC2_Current);
-    INFO_MESSAGE("TEST: solax_LiveData.AC_Current: %.1f A",     solax_LiveData.AC_Current);
-    INFO_MESSAGE("TEST: solax_LiveData.AC_Voltage: %.1f V",     solax_LiveData.AC_Voltage);
-    INFO_MESSAGE("TEST: solax_LiveData.Frequency: %.2f Hz",     solax_LiveData.Frequency);
-    INFO_MESSAGE("TEST: solax_LiveData.Power: %.0f W",          solax_LiveData.Power);
-    INFO_MESSAGE("TEST: solax_LiveData.Energy_Today: %.1f kWh", solax_LiveData.Energy_Today);
-    INFO_MESSAGE("TEST: solax_LiveData.Energy_Total: %.1f kWh", solax_LiveData.Energy_Total);
-    INFO_MESSAGE("TEST: solax_LiveData.Runtime_Total: %.0f h",  solax_LiveData.Runtime_Total);
-    INFO_MESSAGE("TEST: solax_LiveData.Status: %d",             solax_LiveData.Status);
-    INFO_MESSAGE("TEST: solax_LiveData.ErrorBits: 0x%08X",      solax_LiveData.ErrorBits);
-    INFO_MESSAGE("TEST: Counter: %d", cnt);
-    */
+    return 0;
 }
 
 
-int solax_JsonPath(char buffer[], Solax_LiveData_t* liveData)
+int init_Signals(void)
 {
-    static const char* solax_ErrorText[32] =
-    {
-        "Tz Protection Fault",           // Byte 0.0
-        "Mains Lost Fault",              // Byte 0.1
-        "Grid Voltage Fault",            // Byte 0.2
-        "Grid Frequency Fault",          // Byte 0.3
-        "PLL Lost Fault",                // Byte 0.4
-        "Bus Voltage Fault",             // Byte 0.5
-        "Error Bit 06",                  // Byte 0.6
-        "Oscillator Fault",              // Byte 0.7
-        
-        "DCI OCP Fault",                 // Byte 1.0
-        "Residual Current Fault",        // Byte 1.1
-        "PV Voltage Fault",              // Byte 1.2
-        "Ac10Mins Voltage Fault",        // Byte 1.3
-        "Isolation Fault",               // Byte 1.4
-        "Over Temperature Fault",        // Byte 1.5
-        "Ventilator Fault",              // Byte 1.6
-        "Error Bit 15",                  // Byte 1.7
-        
-        "SPI Communication Fault",       // Byte 2.0
-        "SCI Communication Fault",       // Byte 2.1
-        "Error Bit 18",                  // Byte 2.2
-        "Input Configuration Fault",     // Byte 2.3
-        "EEPROM Fault",                  // Byte 2.4
-        "Relay Fault",                   // Byte 2.5
-        "Sample Consistence Fault",      // Byte 2.6
-        "Residual-Current Device Fault", // Byte 2.7
-        
-        "Error Bit 24",                  // Byte 3.0
-        "Error Bit 25",                  // Byte 3.1
-        "Error Bit 26",                  // Byte 3.2
-        "Error Bit 27",                  // Byte 3.3
-        "Error Bit 28",                  // Byte 3.4
-        "DCI Device Fault",              // Byte 3.5
-        "Other Device Fault",            // Byte 3.6
-        "Error Bit 31",                  // Byte 3.7
-    };
+    sigset_t mask;
     
-    INFO_MESSAGE("JsonP: Inverter.Address: %d",            arg_InverterAddr);
-    INFO_MESSAGE("JsonP: Inverter.Online: %d",             solax_InverterOnline);
-    INFO_MESSAGE("JsonP: Inverter.QualityOfService: %.2f", solax_QualityOfService);
-    INFO_MESSAGE("JsonP: LiveData.DC1_Voltage: %.1f V",    liveData->DC1_Voltage);
-    INFO_MESSAGE("JsonP: LiveData.DC2_Voltage: %.1f V",    liveData->DC2_Voltage);
-    INFO_MESSAGE("JsonP: LiveData.DC1_Current: %.1f A",    liveData->DC1_Current);
-    INFO_MESSAGE("JsonP: LiveData.DC2_Current: %.1f A",    liveData->DC2_Current);
-    INFO_MESSAGE("JsonP: LiveData.AC_Current: %.1f A",     liveData->AC_Current);
-    INFO_MESSAGE("JsonP: LiveData.AC_Voltage: %.1f V",     liveData->AC_Voltage);
-    INFO_MESSAGE("JsonP: LiveData.Frequency: %.2f Hz",     liveData->Frequency);
-    INFO_MESSAGE("JsonP: LiveData.Power: %.0f W",          liveData->Power);
-    INFO_MESSAGE("JsonP: LiveData.Energy_Today: %.1f kWh", liveData->Energy_Today);
-    INFO_MESSAGE("JsonP: LiveData.Energy_Total: %.1f kWh", liveData->Energy_Total);
-    INFO_MESSAGE("JsonP: LiveData.Runtime_Total: %.0f h",  liveData->Runtime_Total);
-    INFO_MESSAGE("JsonP: LiveData.Status: %d",             liveData->Status);
-    INFO_MESSAGE("JsonP: LiveData.ErrorBits: 0x%08X",      liveData->ErrorBits);
+    // SIGHUP, SIGUSR1, SIGTERM and SIGINT are handled by the event loop
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) { ERROR_MESSAGE("Init: Error blocking signals: %s", strerror(errno)); return -1; }
     
-    int len = 0;
-    len += sprintf(&buffer[len], "{\r\n");                                                          //
-    len += sprintf(&buffer[len], "  \"inverter\":\r\n");                                            //
-    len += sprintf(&buffer[len], "  {\r\n");                                                        //
-    len += sprintf(&buffer[len], "    \"address\": %d,\r\n",              arg_InverterAddr);        //
-    len += sprintf(&buffer[len], "    \"online\": %d,\r\n",               solax_InverterOnline);    //
-    len += sprintf(&buffer[len], "    \"quality_of_service\": %.2f,\r\n", solax_QualityOfService);  //
-    len += sprintf(&buffer[len], "    \"live_data\":\r\n");                                         //
-    len += sprintf(&buffer[len], "    {\r\n");                                                      //
-    len += sprintf(&buffer[len], "      \"temperature\": %.0f,\r\n",      liveData->Temperature);   //
-    len += sprintf(&buffer[len], "      \"dc1_voltage\": %.1f,\r\n",      liveData->DC1_Voltage);   //
-    len += sprintf(&buffer[len], "      \"dc1_current\": %.1f,\r\n",      liveData->DC1_Current);   //
-    len += sprintf(&buffer[len], "      \"dc2_voltage\": %.1f,\r\n",      liveData->DC2_Voltage);   //
-    len += sprintf(&buffer[len], "      \"dc2_current\": %.1f,\r\n",      liveData->DC2_Current);   //
-    len += sprintf(&buffer[len], "      \"ac_voltage\": %.1f,\r\n",       liveData->AC_Voltage);    //
-    len += sprintf(&buffer[len], "      \"ac_current\": %.1f,\r\n",       liveData->AC_Current);    //
-    len += sprintf(&buffer[len], "      \"frequency\": %.2f,\r\n",        liveData->Frequency);     //
-    len += sprintf(&buffer[len], "      \"power\": %.0f,\r\n",            liveData->Power);         //
-    len += sprintf(&buffer[len], "      \"energy_today\": %.1f,\r\n",     liveData->Energy_Today);  //
-    len += sprintf(&buffer[len], "      \"energy_total\": %.1f,\r\n",     liveData->Energy_Total);  //
-    len += sprintf(&buffer[len], "      \"runtime_total\": %.0f,\r\n",    liveData->Runtime_Total); //
-    len += sprintf(&buffer[len], "      \"status\": %d,\r\n",             liveData->Status);        //
-    len += sprintf(&buffer[len], "      \"error_bits\": %d\r\n",          liveData->ErrorBits);     //
-    len += sprintf(&buffer[len], "    }\r\n");                                                      //
-    len += sprintf(&buffer[len], "  }\r\n");                                                        //
-    len += sprintf(&buffer[len], "}\r\n");                                                          //
+    fd_signal = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd_signal == -1) { ERROR_MESSAGE("Init: Error creating signal descriptor: %s", strerror(errno)); return -1; }
     
-    return len;
+    return 0;
 }
 
 
-
-int poll_HTTP_Server(void)
+int init_Timers(Solax_Bus_t* bus, int interval_ms)
 {
-    int fd_sock_client;
-    struct sockaddr_in addr_client;
-    char response[1000];
-    int len = 0;
-
-    fd_sock_client = accept(fd_sock_server, NULL, NULL);
- 
-    if ((fd_sock_client == -1) && (errno != EWOULDBLOCK))
-    {
-        ERROR_MESSAGE("Http: Error when accepting HTTP-Client connection: %s", strerror(errno));
-        return -1;
-    }
+    bus->timerQuery.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (bus->timerQuery.fd == -1) { ERROR_MESSAGE("Init: Error creating query timer: %s", strerror(errno)); return -1; }
+    
+    bus->timerResponse.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (bus->timerResponse.fd == -1) { ERROR_MESSAGE("Init: Error creating response timer: %s", strerror(errno)); return -1; }
+    
+    // adaptive: one-shot, restarted at the end of each round
+    if (timer_Set(bus->timerQuery.fd, interval_ms, arg_Adaptive ? 0 : interval_ms) == -1) return -1;
     
-    if (fd_sock_client >= 0)  
-    {
-        DEBUG_MESSAGE("HTTP: Got a connection");
-                
-        /*
-        len += sprintf(&response[len], "HTTP/1.0 200 OK\r\n");
-        len += sprintf(&response[len], "Connection: close\r\n");
-        len += sprintf(&response[len], "Content-Type: text/html; charset=utf-8\r\n");
-        len += sprintf(&response[len], "\r\n");
-        len += sprintf(&response[len], "<html><head><title>SolaXd</title></head>\r\n");
-        len += sprintf(&response[len], "<body>\r\n");
-        len += solax_JsonPath(&response[len], &solax_LiveData);
-        len += sprintf(&response[len], "</body></html>\r\n");
-        */
-        
-        len += sprintf(&response[len], "HTTP/1.0 200 OK\r\n");
-        len += sprintf(&response[len], "Connection: close\r\n");
-        len += sprintf(&response[len], "Content-Type: application/json\r\n");
-        len += sprintf(&response[len], "\r\n");
-        len += solax_JsonPath(&response[len], &solax_LiveData);
-
-        write(fd_sock_client, response, len);
-        close(fd_sock_client);
-    }
     return 0;
 }
 
@@ -882,6 +5264,7 @@ int init_HTTP_Server(int port)
     int enable = 1;
     struct sockaddr_in addr_server;
 
+    http_StartTime = time(NULL);
     fd_sock_server = socket(AF_INET, SOCK_STREAM, 0);
     if (fd_sock_server == -1) { ERROR_MESSAGE("Init: Error opening socket for HTTP-Server at port '%d': %s", port, strerror(errno)); return -1; }
     
@@ -898,7 +5281,7 @@ int init_HTTP_Server(int port)
     error = bind(fd_sock_server, (struct sockaddr *) &addr_server, sizeof(addr_server));
     if (error == -1) { ERROR_MESSAGE("Init: Error binding socket for HTTP-Server at port '%d': %s", port, strerror(errno)); return -1; }
 
-    error = listen(fd_sock_server, 10);
+    error = listen(fd_sock_server, MAX_HTTP_CLIENTS * MAX_HTTP_THREADS);
     if (error == -1) { ERROR_MESSAGE("Init: Error listening socket for HTTP-Server at port '%d': %s", port, strerror(errno)); return -1; }
     
     NOTICE_MESSAGE("Init: HTTP-Server at port '%d' created successfully", port);
@@ -906,18 +5289,53 @@ int init_HTTP_Server(int port)
 }
 
 
-int init_Serial_Interface(char device[])
+/* --- Started with the signals blocked, they are handled by the serial thread only --- */
+int init_HTTP_Workers(int count)
+{
+    Http_Worker_t* worker;
+    int i, j;
+    
+    for (i = 0; i < count; i++)
+    {
+        worker = &http_Workers[i];
+        for (j = 0; j < MAX_HTTP_CLIENTS; j++)
+        {
+            worker->connections[j].handler.fd = -1;
+        }
+        worker->server = (Event_Handler_t) { fd_sock_server, poll_HTTP_Server };
+        worker->notify = (Event_Handler_t) { eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), poll_HTTP_Notify };
+        if (worker->notify.fd == -1) { ERROR_MESSAGE("Init: Error creating notify of HTTP thread: %s", strerror(errno)); return -1; }
+        
+        // the handlers are registered in the event loop of the thread, the connections are accepted by one of the threads
+        if (init_Event_Loop() == -1) return -1;
+        worker->fd_epoll = fd_epoll;
+        if (init_Event_Handler(&worker->server, EPOLLIN | EPOLLEXCLUSIVE) == -1) return -1;
+        if (init_Event_Handler(&worker->notify, EPOLLIN) == -1) return -1;
+        fd_epoll = -1;
+        
+        errno = pthread_create(&worker->thread, NULL, http_Worker_Run, worker);
+        if (errno != 0) { ERROR_MESSAGE("Init: Error starting HTTP thread: %s", strerror(errno)); return -1; }
+        http_WorkerCount++;
+    }
+    
+    NOTICE_MESSAGE("Init: %d HTTP thread(s) started", count);
+    return 0;
+}
+
+
+int init_Serial_Interface(Solax_Bus_t* bus)
 {
+    const char* device = bus->device;
     struct termios tty;
     
-    fd_tty = open(device, O_RDWR | O_NOCTTY | O_SYNC);
-    if (fd_tty < 0)
+    bus->handler.fd = open(device, O_RDWR | O_NOCTTY | O_SYNC);
+    if (bus->handler.fd < 0)
     {
         ERROR_MESSAGE("Init: Error opening '%s': %s", device, strerror(errno));
         return -1;
     }
     
-    if (tcgetattr(fd_tty, &tty) < 0)
+    if (tcgetattr(bus->handler.fd, &tty) < 0)
     {
         ERROR_MESSAGE("Init: Error opening '%s': %s", device, strerror(errno));
         return -1;
@@ -941,7 +5359,7 @@ int init_Serial_Interface(char device[])
     tty.c_cc[VMIN] = 0;
     tty.c_cc[VTIME] = 0;
     
-    if (tcsetattr(fd_tty, TCSANOW, &tty) != 0)
+    if (tcsetattr(bus->handler.fd, TCSANOW, &tty) != 0)
     {
         ERROR_MESSAGE("Init: Error opening '%s': %s", device, strerror(errno));
         return -1;
@@ -952,6 +5370,163 @@ int init_Serial_Interface(char device[])
 }
 
 
+int transport_TTY_Query(Solax_Bus_t* bus)
+{
+    tcflush(bus->handler.fd, TCIFLUSH);    // discard late responses of the previous query
+    return 0;
+}
+
+
+int transport_TTY_Write(Solax_Bus_t* bus, const void* data, int length)
+{
+    return write(bus->handler.fd, data, length);
+}
+
+
+/* --- RS485 gateway, e.g. ser2net: "tcp://host:port", connected by the query schedule and reconnected after errors --- */
+int transport_TCP_Open(Solax_Bus_t* bus)
+{
+    const char* name = bus->device + strlen("tcp://");
+    int error;
+    
+    if (strchr(name, ':') == NULL) { ERROR_MESSAGE("Init: Device '%s' has no port, e.g. tcp://gateway:4001", bus->device); errno = EINVAL; return -1; }
+    
+    error = net_Resolve(name, 0, &bus->addr, &bus->addrLen);
+    if (error) { ERROR_MESSAGE("Init: Error resolving device '%s': %s", bus->device, gai_strerror(error)); errno = EINVAL; return -1; }
+    
+    NOTICE_MESSAGE("Init: Device '%s' resolved successfully", bus->device);
+    return 0;
+}
+
+
+int transport_TCP_Error(Solax_Bus_t* bus, const char message[])
+{
+    if (errno == EAGAIN) return 0;    // connection still in progress, the query times out
+    
+    if (bus->connected) { NOTICE_MESSAGE("%s '%s': %s", message, bus->device, strerror(errno)); }
+    else { DEBUG_MESSAGE("%s '%s': %s", message, bus->device, strerror(errno)); }
+    
+    if (bus->handler.fd >= 0)
+    {
+        epoll_ctl(fd_epoll, EPOLL_CTL_DEL, bus->handler.fd, NULL);
+        close(bus->handler.fd);
+        bus->handler.fd = -1;
+    }
+    bus->connected = false;
+    
+    // reconnect with exponential backoff, the inverters of the bus time out meanwhile
+    bus->backoff = (bus->backoff == 0) ? arg_QueryInterval : bus->backoff * 2;
+    if (bus->backoff > RECONNECT_BACKOFF_MAX) bus->backoff = RECONNECT_BACKOFF_MAX;
+    bus->reconnectTime = timing_Now() / 1000000 + bus->backoff;
+    return 0;
+}
+
+
+int transport_TCP_Query(Solax_Bus_t* bus)
+{
+    uint8_t buff[FRAMER_BUFFER_SIZE];
+    struct sockaddr_storage peer;
+    socklen_t peerLen = sizeof(peer);
+    int enable = 1;
+    
+    if (bus->handler.fd < 0)
+    {
+        if (timing_Now() / 1000000 < bus->reconnectTime) return 0;
+        
+        bus->handler.fd = socket(bus->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (bus->handler.fd == -1) { ERROR_MESSAGE("ComTx: Error opening socket for '%s': %s", bus->device, strerror(errno)); return -1; }
+        setsockopt(bus->handler.fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        
+        if ((connect(bus->handler.fd, (struct sockaddr*)&bus->addr, bus->addrLen) == -1) && (errno != EINPROGRESS))
+        {
+            return transport_TCP_Error(bus, "ComTx: Error connecting");
+        }
+        DEBUG_MESSAGE("ComTx: Connecting '%s'", bus->device);
+        if (init_Event_Handler(&bus->handler, EPOLLIN | EPOLLRDHUP) == -1) return -1;
+    }
+    
+    if (!bus->connected && (getpeername(bus->handler.fd, (struct sockaddr*)&peer, &peerLen) == 0))
+    {
+        NOTICE_MESSAGE("ComTx: Connected to '%s'", bus->device);
+        bus->connected = true;
+        bus->backoff = 0;
+    }
+    
+    while (read(bus->handler.fd, buff, sizeof(buff)) > 0);    // discard late responses of the previous query
+    return 0;
+}
+
+
+int transport_TCP_Write(Solax_Bus_t* bus, const void* data, int length)
+{
+    return send(bus->handler.fd, data, length, MSG_NOSIGNAL);
+}
+
+
+/* the socket pair of the replay is read when the query is replayed */
+int transport_Replay_Query(Solax_Bus_t* bus)
+{
+    uint8_t buff[FRAMER_BUFFER_SIZE];
+    
+    while (read(bus->handler.fd, buff, sizeof(buff)) > 0);
+    return replay_Query(&replay_File);
+}
+
+
+/* --- Transports of the buses, selected by the prefix of the device --- */
+static const Solax_Transport_t solax_Transports[] =
+{
+    { "tcp://", transport_TCP_Open,    transport_TCP_Query, transport_TCP_Write, transport_TCP_Error },
+    { "",       init_Serial_Interface, transport_TTY_Query, transport_TTY_Write, NULL },
+};
+static const Solax_Transport_t solax_TransportReplay = { NULL, NULL, transport_Replay_Query, transport_TTY_Write, NULL };
+
+
+const Solax_Transport_t* solax_Transport_Find(const char device[])
+{
+    int i;
+    
+    for (i = 0; strncmp(device, solax_Transports[i].prefix, strlen(solax_Transports[i].prefix)) != 0; i++);
+    return &solax_Transports[i];
+}
+
+
+/* --- Fast replay: the queries follow each other without waiting, measures decoding and averaging throughput --- */
+int replay_Run(Replay_t* replay, Solax_Bus_t* bus)
+{
+    struct timespec timeStart, timeEnd;
+    uint64_t samples = 0;
+    double elapsed;
+    int i;
+    
+    clock_gettime(CLOCK_MONOTONIC, &timeStart);
+    while (!replay->done)
+    {
+        if (solax_QueryRound_Start(bus) == -1) return -1;
+        while (bus->queryPending)
+        {
+            while (!replay->done && (replay->next.direction == CAPTURE_RX)) replay_Deliver(replay);
+            if (solax_LiveData_Update(bus, true) == -1) return -1;
+            if (solax_QueryRound_Next(bus) == -1) return -1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &timeEnd);
+    
+    for (i = 0; i < solax_InverterCount; i++)
+    {
+        samples += solax_Inverters[i].SampleCount;
+    }
+    elapsed = (timeEnd.tv_sec - timeStart.tv_sec) + (timeEnd.tv_nsec - timeStart.tv_nsec) / 1e9;
+    NOTICE_MESSAGE("Replay: %llu exchanges, %llu samples, %.1f s of capture in %.3f s (%.0f exchanges/s)",
+                   (unsigned long long)replay->exchanges, (unsigned long long)samples, (replay->clock - bus->timeStart * 1000000) / 1e9,
+                   elapsed, (elapsed > 0) ? replay->exchanges / elapsed : 0);
+    
+    if (history_File.header != NULL) history_Sync(&history_File);
+    if (fp_capture_file != NULL) fflush(fp_capture_file);
+    return 0;
+}
+
+
 
 /*** MAIN ******************************************************************************************/
 
@@ -959,8 +5534,12 @@ int main(int argc, char* argv[])
 {
     int opt;
     int error;
-    uint8_t index = 0;
-    Solax_LiveData_t liveData[MAX_INDEX_OF_LIVE_DATA + 1] = {0};
+    int i, count;
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    Event_Handler_t* handler;
+    Event_Handler_t handlerSignal = { -1, poll_Signal };
+    Solax_Bus_t* bus = NULL;
+    char* token;
 
     if ((argc == 2) && (strcmp(argv[1], "--version") == 0))
     {
@@ -977,33 +5556,70 @@ int main(int argc, char* argv[])
         printf("Usage: %s [OPTION] ...\n", SOLARXD_STRING);
         printf("Daemon for communication with SolaX-X1_Mini inverter via RS485.\n");
         printf("    Options:      The default value for each option is shown in square brackets.\n");
-        printf("      -d <DEV>    Use DEV as SolaXd serial port device  [%s]\n", DEFAULT_TTY_DEVICE_NAME);
+        printf("      -d <DEV>    Use DEV as SolaXd serial port device or tcp://HOST:PORT of a gateway, once per bus for more buses  [%s]\n", DEFAULT_TTY_DEVICE_NAME);
         printf("      -p <PORT>   Port of HTTP-Server  [%d]\n", DEFAULT_TCP_PORT);
-        printf("      -s <SAMPLE> Samples used for average calculation  [%d]\n", DEFAULT_AVERAGE_SAMPLES);
-        printf("      -a <ADDR>   Use ADDR as inverter bus address  [%d]\n", DEFAULT_INVERTER_ADDRESS);
+        printf("      -w <THREADS> HTTP threads, separate from the serial interface  [%d]\n", DEFAULT_HTTP_THREADS);
+        printf("      -s <SECONDS> Interval used for average calculation  [%d]\n", DEFAULT_AVERAGE_SAMPLES);
+        printf("      -i <MS>     Query interval in milliseconds  [%d]\n", DEFAULT_QUERY_INTERVAL);
+        printf("      -A          Adaptive query interval: -i at the shortest, slow poll while offline\n");
+        printf("      -a <ADDR>   Use ADDR as inverter bus address, a comma separated list for more inverters on the bus of the last -d  [%d]\n", DEFAULT_INVERTER_ADDRESS);
         printf("      -l <FILE>   Write log to FILE, instead to stderr\n");
         printf("      -L <LEVEL>  LEVEL: 0=error/1=notice/2=info/3=debug/4=trace  [%d]\n", DEFAULT_LOG_LEVEL);
+        printf("      -T <N>      Trace the frames of 1 in N exchanges, faulty frames always, 0 = faulty frames only  [%d]\n", DEFAULT_TRACE_SAMPLE);
+        printf("      -m <HOST>   Publish live data to MQTT broker HOST[:PORT]\n");
+        printf("      -t <TOPIC>  MQTT topic prefix  [%s]\n", DEFAULT_MQTT_TOPIC);
+        printf("      -D <DEADBAND> Minimum change of a value to be published to MQTT (in percent)  [%d]\n", DEFAULT_MQTT_DEADBAND);
+        printf("      -I <SERVER> Export the samples to InfluxDB SERVER HOST[:PORT][/PATH]  [%s]\n", DEFAULT_INFLUX_PATH);
+        printf("      -F <FILE>   Spill file of the InfluxDB exporter while the server is not reachable\n");
+        printf("      -H <FILE>   Keep a persistent sample history in FILE\n");
+        printf("      -S <SECONDS> Write back interval of the history file  [%d]\n", DEFAULT_HISTORY_SYNC);
+        printf("      -M <NAME>   Publish the live data to the POSIX shared memory NAME, e.g. /solaxd\n");
+        printf("      -N <PATH>   Notify socket of the shared memory, one packet per update\n");
+        printf("      -P <FILE>   Keep the state of the inverters in FILE for a warm start\n");
+        printf("      -C <FILE>   Config file read again on SIGHUP for -s, -L and -l  [%s]\n", DEFAULT_CONFIG_FILE);
+        printf("      -c <FILE>   Capture the raw bus traffic to FILE\n");
+        printf("      -r <FILE>   Replay the capture FILE instead of using the serial port\n");
+        printf("      -f          Replay as fast as possible and exit, instead of in real time\n");
         printf("      -x          Enable test mode with simulated inverter data\n");
         printf("      --help      Display this help and exit\n");
         printf("      --version   Output version information and exit\n");
         return 0;
     }
     
-    while ((opt = getopt (argc, argv, ":d:p:s:a:l:L:x")) != -1)
+    while ((opt = getopt (argc, argv, arg_Options)) != -1)
     {
         switch (opt)
         {
             case 'd':
-                arg_TTY_Device = optarg;
+                bus = solax_Bus_Add(optarg);
+                if (bus == NULL) { fprintf(stderr, "Too many devices, maximum is %d.\n", MAX_BUSES); return -1; }
                 break;
             case 'p':
                 arg_TCP_Port = atoi(optarg);
                 break;
+            case 'w':
+                arg_HttpThreads = atoi(optarg);
+                if ((arg_HttpThreads < 1) || (arg_HttpThreads > MAX_HTTP_THREADS)) { fprintf(stderr, "HTTP threads must be in range 1..%d.\n", MAX_HTTP_THREADS); return -1; }
+                break;
             case 's':
                 arg_AV_Samples = atoi(optarg);
+                if ((arg_AV_Samples < 1) || (arg_AV_Samples > MAX_AVERAGE_INTERVAL)) { fprintf(stderr, "Average interval must be in range 1..%d seconds.\n", MAX_AVERAGE_INTERVAL); return -1; }
+                break;
+            case 'i':
+                arg_QueryInterval = atoi(optarg);
+                if (arg_QueryInterval < MIN_QUERY_INTERVAL) { fprintf(stderr, "Query interval must be at least %d ms.\n", MIN_QUERY_INTERVAL); return -1; }
+                break;
+            case 'A':
+                arg_Adaptive = 1;
                 break;
             case 'a':
-                arg_InverterAddr = atoi(optarg);
+                // list of inverter addresses, e.g. "-a 10,11" or "-a 10 -a 11"
+                if (bus == NULL) bus = solax_Bus_Add(NULL);
+                for (token = strtok(optarg, ","); token != NULL; token = strtok(NULL, ","))
+                {
+                    if (solax_Inverter_Find(atoi(token)) != NULL) { fprintf(stderr, "Inverter address %d is used twice, it must be unique on all buses.\n", atoi(token)); return -1; }
+                    if (solax_Inverter_Add(bus, atoi(token)) == NULL) { fprintf(stderr, "Too many inverters, maximum is %d.\n", MAX_INVERTERS); return -1; }
+                }
                 break;
             case 'l':
                 arg_LogFile = optarg;
@@ -1011,6 +5627,52 @@ int main(int argc, char* argv[])
             case 'L':
                 arg_LogLevel = atoi(optarg);
                 break;
+            case 'T':
+                arg_TraceSample = atoi(optarg);
+                if (arg_TraceSample < 0) { fprintf(stderr, "Trace sample must be 0 or more.\n"); return -1; }
+                break;
+            case 'm':
+                arg_MqttBroker = optarg;
+                break;
+            case 't':
+                arg_MqttTopic = optarg;
+                break;
+            case 'D':
+                arg_MqttDeadband = atof(optarg);
+                break;
+            case 'I':
+                arg_InfluxServer = optarg;
+                break;
+            case 'F':
+                arg_InfluxSpill = optarg;
+                break;
+            case 'H':
+                arg_HistoryFile = optarg;
+                break;
+            case 'S':
+                arg_HistorySync = atoi(optarg);
+                break;
+            case 'M':
+                arg_ShmName = optarg;
+                break;
+            case 'N':
+                arg_ShmNotify = optarg;
+                break;
+            case 'P':
+                arg_StateFile = optarg;
+                break;
+            case 'C':
+                arg_ConfigFile = optarg;
+                break;
+            case 'c':
+                arg_CaptureFile = optarg;
+                break;
+            case 'r':
+                arg_ReplayFile = optarg;
+                break;
+            case 'f':
+                arg_ReplayFast = 1;
+                break;
             case 'x':
                 arg_TestMode = 1;
                 break;
@@ -1027,6 +5689,26 @@ int main(int argc, char* argv[])
                 abort();
         }
     }
+    arg_StartAV_Samples = arg_AV_Samples;
+    arg_StartLogFile = arg_LogFile;
+    arg_StartLogLevel = arg_LogLevel;
+    
+    // one bus with the default device and address, unless given
+    if (solax_BusCount == 0) solax_Bus_Add(NULL);
+    for (i = 0; i < solax_BusCount; i++)
+    {
+        bus = &solax_Buses[i];
+        if (bus->device == NULL) bus->device = DEFAULT_TTY_DEVICE_NAME;
+        bus->transport = (arg_ReplayFile != NULL) ? &solax_TransportReplay : solax_Transport_Find(bus->device);
+        bus->roundPeriod = arg_QueryInterval;
+        if (bus->inverterCount > 0) continue;
+        if ((solax_Inverter_Find(DEFAULT_INVERTER_ADDRESS + i) != NULL) || (solax_Inverter_Add(bus, DEFAULT_INVERTER_ADDRESS + i) == NULL))
+        {
+            fprintf(stderr, "Default address %d of device '%s' is used already, use -a after -d.\n", DEFAULT_INVERTER_ADDRESS + i, bus->device);
+            return -1;
+        }
+    }
+    if ((arg_ReplayFile != NULL) && (solax_BusCount > 1)) { fprintf(stderr, "Replay of a capture is supported for one device only.\n"); return -1; }
     
     if (arg_LogFile == NULL)
     {
@@ -1038,36 +5720,143 @@ int main(int argc, char* argv[])
         if (fp_log_file == NULL) { printf("Main: Error opening Log-File '%s': %s\n", arg_LogFile, strerror(errno)); return errno; }
     }
     
+    log_Init();
+    if (log_Start(fp_log_file) == -1) return -1;
+    atexit(log_Stop);
+    
     NOTICE_MESSAGE("Main: %s started", SOLARXD_STRING);
     
-    INFO_MESSAGE("Main: TTY_Device   : %s", arg_TTY_Device  );
+    for (i = 0; i < solax_BusCount; i++)
+    {
+        INFO_MESSAGE("Main: TTY_Device   : %s", solax_Buses[i].device);
+    }
     INFO_MESSAGE("Main: TCP_Port     : %d", arg_TCP_Port    );
+    INFO_MESSAGE("Main: HttpThreads  : %d", arg_HttpThreads );
     INFO_MESSAGE("Main: AV_Samples   : %d", arg_AV_Samples  );
-    INFO_MESSAGE("Main: InverterAddr : %d", arg_InverterAddr);
+    INFO_MESSAGE("Main: QueryInterval: %d", arg_QueryInterval);
+    INFO_MESSAGE("Main: Adaptive     : %d", arg_Adaptive    );
+    for (i = 0; i < solax_InverterCount; i++)
+    {
+        solax_Inverters[i].Window.length = arg_AV_Samples * 1000;
+        INFO_MESSAGE("Main: InverterAddr : %d (%s)", solax_Inverters[i].Address, solax_Inverters[i].Bus->device);
+    }
     INFO_MESSAGE("Main: LogFile      : %s", arg_LogFile     );
     INFO_MESSAGE("Main: LogLevel     : %d", arg_LogLevel    );
+    INFO_MESSAGE("Main: TraceSample  : %d", arg_TraceSample );
     INFO_MESSAGE("Main: TestMode     : %d", arg_TestMode    );
+    INFO_MESSAGE("Main: MqttBroker   : %s", arg_MqttBroker  );
+    INFO_MESSAGE("Main: MqttTopic    : %s", arg_MqttTopic   );
+    INFO_MESSAGE("Main: MqttDeadband : %.1f", arg_MqttDeadband);
+    INFO_MESSAGE("Main: InfluxServer : %s", arg_InfluxServer);
+    INFO_MESSAGE("Main: InfluxSpill  : %s", arg_InfluxSpill );
+    INFO_MESSAGE("Main: HistoryFile  : %s", arg_HistoryFile );
+    INFO_MESSAGE("Main: HistorySync  : %d", arg_HistorySync );
+    INFO_MESSAGE("Main: ShmName      : %s", arg_ShmName     );
+    INFO_MESSAGE("Main: ShmNotify    : %s", arg_ShmNotify   );
+    INFO_MESSAGE("Main: StateFile    : %s", arg_StateFile   );
+    INFO_MESSAGE("Main: ConfigFile   : %s", arg_ConfigFile  );
+    INFO_MESSAGE("Main: CaptureFile  : %s", arg_CaptureFile );
+    INFO_MESSAGE("Main: ReplayFile   : %s", arg_ReplayFile  );
+    INFO_MESSAGE("Main: ReplayFast   : %d", arg_ReplayFast  );
     
-    error = init_Serial_Interface(arg_TTY_Device);  // open COM-Port
-    if (error == -1) return errno;
+    if (arg_HistoryFile != NULL)
+    {
+        if (history_Open(&history_File, arg_HistoryFile) == -1) return errno;
+    }
+    
+    if (arg_StateFile != NULL)
+    {
+        if (state_Load(arg_StateFile) == -1) return errno;
+    }
+    
+    if (arg_ShmName != NULL)
+    {
+        if (shm_Open(&shm_Data, arg_ShmName) == -1) return errno;
+        if ((arg_ShmNotify != NULL) && (shm_Notify_Open(&shm_Data, arg_ShmNotify) == -1)) return errno;
+    }
+    
+    if (arg_CaptureFile != NULL)
+    {
+        if (capture_Open(arg_CaptureFile) == -1) return errno;
+    }
+    
+    if (arg_ReplayFile != NULL)
+    {
+        error = replay_Open(&replay_File, &solax_Buses[0], arg_ReplayFile, arg_ReplayFast);
+        if (error == -1) return errno;
+    }
+    for (i = 0; i < solax_BusCount; i++)
+    {
+        if (arg_ReplayFile == NULL)
+        {
+            error = solax_Buses[i].transport->open(&solax_Buses[i]);  // open COM-Port
+            if (error == -1) return errno;
+        }
+        error = init_Timers(&solax_Buses[i], arg_QueryInterval); // start query schedule
+        if (error == -1) return errno;
+    }
+    
+    if (replay_File.fast) return replay_Run(&replay_File, &solax_Buses[0]);
     
     error = init_HTTP_Server(arg_TCP_Port);         // open TCP-Listener
     if (error == -1) return errno;
+    solax_Snapshot_Publish();
+    
+    error = init_Signals();
+    if (error == -1) return errno;
+    
+    error = init_HTTP_Workers(arg_HttpThreads);     // serve HTTP in threads of their own
+    if (error == -1) return errno;
+    
+    error = init_Event_Loop();
+    if (error == -1) return errno;
+    
+    handlerSignal.fd = fd_signal;
+    
+    // all buses are serviced by the event loop of the serial thread, each with its own timers
+    for (i = 0; i < solax_BusCount; i++)
+    {
+        if ((solax_Buses[i].handler.fd >= 0) && (init_Event_Handler(&solax_Buses[i].handler, EPOLLIN) == -1)) return errno;
+        if (init_Event_Handler(&solax_Buses[i].timerQuery, EPOLLIN) == -1) return errno;
+        if (init_Event_Handler(&solax_Buses[i].timerResponse, EPOLLIN) == -1) return errno;
+    }
+    if (init_Event_Handler(&handlerSignal, EPOLLIN) == -1) return errno;
+    if (replay_File.fp != NULL)
+    {
+        if (init_Event_Handler(&replay_File.handler, EPOLLIN) == -1) return errno;
+    }
+    if (shm_Data.handler.fd >= 0)
+    {
+        shm_Data.handler.callback = poll_Shm_Notify;
+        if (init_Event_Handler(&shm_Data.handler, EPOLLIN) == -1) return errno;
+    }
+    
+    if (arg_MqttBroker != NULL)
+    {
+        if (init_MQTT_Client(&mqtt_Client, arg_MqttBroker) == -1) return errno;
+    }
+    
+    if (arg_InfluxServer != NULL)
+    {
+        if (init_Influx_Client(&influx_Client, arg_InfluxServer, arg_InfluxSpill) == -1) return errno;
+    }
     
     while (1)
     {
-        error = solax_QueryHandle(&liveData[index]);
-        if (error == -1) return errno;
-        
-        solax_LiveData_Average(liveData, index, MAX_INDEX_OF_LIVE_DATA);
-        
-        index++;
-        if (index > MAX_INDEX_OF_LIVE_DATA) index = 0;
-        
-        error = poll_HTTP_Server();
-        if (error == -1) return errno;
+        count = epoll_wait(fd_epoll, events, MAX_EPOLL_EVENTS, -1);
+        if (count == -1)
+        {
+            if (errno == EINTR) continue;
+            ERROR_MESSAGE("Main: Error waiting for events: %s", strerror(errno));
+            return errno;
+        }
         
-        sleep(1);
+        for (i = 0; i < count; i++)
+        {
+            handler = events[i].data.ptr;
+            error = handler->callback(handler, events[i].events);
+            if (error == -1) return errno;
+        }
     }
     return errno;
 }
@@ -0,0 +1,609 @@
+/*
+    End-to-end benchmark of solaXd with simulated SolaX-X1_Mini inverters
+
+    Copyright (C) 2020 - Jens Jordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*********************************************************************************************/
+
+#define _GNU_SOURCE
+
+
+/*** Defines ********************************************************************************************/
+
+#define BENCH_STRING               "SolaXd-Bench"
+
+#define DEFAULT_SOLAXD_BINARY      "./solaxd"
+#define DEFAULT_TCP_PORT           16789
+#define DEFAULT_INVERTERS          1                      // simulated inverters, bus addresses 10, 11, ...
+#define DEFAULT_DURATION           10                     // measurement (in seconds)
+#define DEFAULT_CLIENTS            4                      // HTTP load generator connections
+#define DEFAULT_LATENCY            30                     // response delay of the simulated inverter (in milliseconds)
+#define DEFAULT_CRC_ERRORS         0                      // responses with a wrong checksum (in percent)
+#define DEFAULT_PARTIAL_FRAMES     0                      // responses written in two parts (in percent)
+#define DEFAULT_QUERY_INTERVAL     1000                   // passed to solaXd (in milliseconds)
+
+#define FIRST_ADDRESS              10
+#define MAX_INVERTERS              8
+#define WARMUP_TIMEOUT             30                     // until the first sample of each inverter (in seconds)
+#define PARTIAL_GAP_MS             10                     // pause inside a partial frame (in milliseconds)
+#define MAX_LATENCY_SAMPLES        100000
+#define HTTP_BUFFER_SIZE           16384
+
+
+/*** Includes ********************************************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+
+/*** Typedefs ******************************************************************************************/
+
+typedef struct
+{
+    uint8_t  serialNumber[14];
+    uint8_t  address;               // 0 = not registered
+    int64_t  responseTime;          // monotonic time the last live data response was written (in nanoseconds)
+} Bench_Inverter_t;
+
+typedef struct
+{
+    uint64_t queries;               // frames received from solaXd
+    uint64_t responses;             // frames written to solaXd
+    uint64_t crcErrors;
+    uint64_t partialFrames;
+} Bench_Bus_t;
+
+
+/*** Variables *****************************************************************************************/
+
+static char*      arg_Binary        = DEFAULT_SOLAXD_BINARY;
+static int        arg_TCP_Port      = DEFAULT_TCP_PORT;
+static int        arg_Inverters     = DEFAULT_INVERTERS;
+static int        arg_Duration      = DEFAULT_DURATION;
+static int        arg_Clients       = DEFAULT_CLIENTS;
+static int        arg_Latency       = DEFAULT_LATENCY;
+static int        arg_CrcErrors     = DEFAULT_CRC_ERRORS;
+static int        arg_PartialFrames = DEFAULT_PARTIAL_FRAMES;
+static int        arg_QueryInterval = DEFAULT_QUERY_INTERVAL;
+
+static int        fd_pty_master     = -1;
+static Bench_Inverter_t bench_Inverters[MAX_INVERTERS];
+static Bench_Bus_t      bench_Bus = {0};
+
+static volatile bool    bench_Running = true;
+static volatile bool    bench_Measuring = false;    // counters and latencies are taken while measuring
+static uint64_t         bench_Requests = 0;         // completed HTTP requests while measuring
+static uint64_t         bench_Samples = 0;          // valid raw samples seen in /stream while measuring
+static int              bench_Ready = 0;            // inverters with at least one sample
+static double           bench_Latency[MAX_LATENCY_SAMPLES];   // response written until seen in /stream (in milliseconds)
+static int              bench_LatencyCount = 0;
+static pthread_mutex_t  bench_Mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*** Functions *****************************************************************************************/
+
+int64_t bench_Now(void)
+{
+    struct timespec timeNow;
+    
+    clock_gettime(CLOCK_MONOTONIC, &timeNow);
+    return (int64_t)timeNow.tv_sec * 1000000000 + timeNow.tv_nsec;
+}
+
+
+void bench_Sleep(int ms)
+{
+    struct timespec delay = { ms / 1000, (ms % 1000) * 1000000 };
+    
+    while ((nanosleep(&delay, &delay) == -1) && (errno == EINTR));
+}
+
+
+
+/* --- Simulated inverters on the master side of a pseudo-terminal --- */
+int sim_Frame(uint8_t frame[], uint8_t source, uint8_t destination, uint8_t controlCode, uint8_t functionCode, const uint8_t data[], int dataLen)
+{
+    uint16_t crc = 0;
+    int len = 0;
+    int i;
+    
+    frame[len++] = 0xAA;
+    frame[len++] = 0x55;
+    frame[len++] = 0x00;
+    frame[len++] = source;
+    frame[len++] = (destination == 0) ? 0x00 : 0x01;
+    frame[len++] = 0x00;
+    frame[len++] = controlCode;
+    frame[len++] = functionCode;
+    frame[len++] = dataLen;
+    memcpy(&frame[len], data, dataLen);
+    len += dataLen;
+    
+    for (i = 0; i < len; i++) crc += frame[i];
+    frame[len++] = crc >> 8;
+    frame[len++] = crc & 0xFF;
+    return len;
+}
+
+
+int sim_LiveData(uint8_t data[], int index)
+{
+    int t = (bench_Now() / 1000000000) % 100;
+    const uint16_t values[10] = { 30 + index, 11, 3000 + t, 0, 31, 0, 21, 2337, 4999, 480 + t };
+    int i;
+    
+    memset(data, 0, 50);
+    for (i = 0; i < 10; i++)
+    {
+        data[2 * i]     = values[i] >> 8;
+        data[2 * i + 1] = values[i] & 0xFF;
+    }
+    data[24] = 4819 >> 8;  data[25] = 4819 & 0xFF;    // energy total
+    data[28] = 2575 >> 8;  data[29] = 2575 & 0xFF;    // runtime total
+    data[31] = 2;                                       // status
+    return 50;
+}
+
+
+void sim_Write(const uint8_t frame[], int len, int index)
+{
+    uint8_t corrupted[128];
+    int part = len;
+    
+    bench_Sleep(arg_Latency);
+    
+    if ((rand() % 100) < arg_CrcErrors)
+    {
+        memcpy(corrupted, frame, len);
+        corrupted[len - 1] ^= 0x5A;
+        frame = corrupted;
+        if (bench_Measuring) __atomic_fetch_add(&bench_Bus.crcErrors, 1, __ATOMIC_RELAXED);
+    }
+    if ((rand() % 100) < arg_PartialFrames)
+    {
+        part = 1 + rand() % (len - 1);
+        if (bench_Measuring) __atomic_fetch_add(&bench_Bus.partialFrames, 1, __ATOMIC_RELAXED);
+    }
+    
+    if (part < len)
+    {
+        if (write(fd_pty_master, frame, part) != part) return;
+        bench_Sleep(PARTIAL_GAP_MS);
+    }
+    
+    // stored before the frame is completed, solaXd may publish the sample before write() returns
+    if (index >= 0) __atomic_store_n(&bench_Inverters[index].responseTime, bench_Now(), __ATOMIC_RELEASE);
+    if (write(fd_pty_master, &frame[part < len ? part : 0], part < len ? len - part : len) <= 0) return;
+    if (bench_Measuring) __atomic_fetch_add(&bench_Bus.responses, 1, __ATOMIC_RELAXED);
+}
+
+
+void sim_Handle(const uint8_t query[])
+{
+    uint8_t frame[128];
+    uint8_t data[64];
+    int len, dataLen, i;
+    
+    if (bench_Measuring) __atomic_fetch_add(&bench_Bus.queries, 1, __ATOMIC_RELAXED);
+    
+    if ((query[6] == 0x10) && (query[7] == 0x00))
+    {
+        // broadcast, answered by the first unregistered inverter
+        for (i = 0; i < arg_Inverters; i++)
+        {
+            if (bench_Inverters[i].address) continue;
+            len = sim_Frame(frame, 0xFF, 0, 0x10, 0x80, bench_Inverters[i].serialNumber, 14);
+            sim_Write(frame, len, -1);
+            return;
+        }
+    }
+    else if ((query[6] == 0x10) && (query[7] == 0x01) && (query[8] == 0x0F))
+    {
+        for (i = 0; i < arg_Inverters; i++)
+        {
+            if (memcmp(bench_Inverters[i].serialNumber, &query[9], 14) != 0) continue;
+            bench_Inverters[i].address = query[23];
+            data[0] = 0x06;
+            len = sim_Frame(frame, query[23], 0, 0x10, 0x81, data, 1);
+            sim_Write(frame, len, -1);
+            return;
+        }
+    }
+    else if ((query[6] == 0x11) && (query[7] == 0x02))
+    {
+        for (i = 0; i < arg_Inverters; i++)
+        {
+            if ((bench_Inverters[i].address == 0) || (bench_Inverters[i].address != query[5])) continue;
+            dataLen = sim_LiveData(data, i);
+            len = sim_Frame(frame, query[5], 1, 0x11, 0x82, data, dataLen);
+            sim_Write(frame, len, i);
+            return;
+        }
+    }
+}
+
+
+void* sim_Thread(void* arg)
+{
+    uint8_t buffer[512];
+    struct pollfd pfd = { .fd = fd_pty_master, .events = POLLIN };
+    int count = 0;
+    int start, frameLen, rxLen;
+    (void)arg;
+    
+    while (bench_Running)
+    {
+        if (poll(&pfd, 1, 100) <= 0) continue;
+        rxLen = read(fd_pty_master, &buffer[count], sizeof(buffer) - count);
+        if (rxLen <= 0) continue;
+        count += rxLen;
+        
+        // queries of solaXd, resync on header 0xAA 0x55
+        start = 0;
+        while (count - start >= 11)
+        {
+            if ((buffer[start] != 0xAA) || (buffer[start + 1] != 0x55)) { start++; continue; }
+            frameLen = buffer[start + 8] + 11;
+            if (frameLen > count - start) break;
+            sim_Handle(&buffer[start]);
+            start += frameLen;
+        }
+        memmove(buffer, &buffer[start], count - start);
+        count -= start;
+        if (count == sizeof(buffer)) count = 0;
+    }
+    return NULL;
+}
+
+
+int sim_Open(char slaveName[], int size)
+{
+    struct termios tty;
+    int fd_slave;
+    
+    fd_pty_master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((fd_pty_master == -1) || (grantpt(fd_pty_master) == -1) || (unlockpt(fd_pty_master) == -1)) return -1;
+    if (ptsname_r(fd_pty_master, slaveName, size) != 0) return -1;
+    
+    // raw before solaXd opens it, no echo of the queries
+    fd_slave = open(slaveName, O_RDWR | O_NOCTTY);
+    if (fd_slave == -1) return -1;
+    tcgetattr(fd_slave, &tty);
+    cfmakeraw(&tty);
+    tcsetattr(fd_slave, TCSANOW, &tty);
+    return fd_slave;    // kept open, the master never sees a hangup
+}
+
+
+
+/* --- HTTP load generator and sample latency probe --- */
+int http_Connect(void)
+{
+    struct sockaddr_in addr = {0};
+    int fd, enable = 1;
+    
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) return -1;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(arg_TCP_Port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) { close(fd); return -1; }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    return fd;
+}
+
+
+/* closed loop: one keep-alive GET after the other */
+void* http_Client_Thread(void* arg)
+{
+    static const char request[] = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    char buffer[HTTP_BUFFER_SIZE];
+    char* header;
+    int fd = -1;
+    int len, rxLen, expected;
+    (void)arg;
+    
+    while (bench_Running)
+    {
+        if (fd == -1) fd = http_Connect();
+        if (fd == -1) { bench_Sleep(100); continue; }
+        
+        if (write(fd, request, sizeof(request) - 1) != sizeof(request) - 1) { close(fd); fd = -1; continue; }
+        
+        len = 0;
+        expected = -1;
+        while ((expected < 0) || (len < expected))
+        {
+            rxLen = read(fd, &buffer[len], sizeof(buffer) - 1 - len);
+            if (rxLen <= 0) break;
+            len += rxLen;
+            buffer[len] = '\0';
+            if ((expected < 0) && ((header = strstr(buffer, "\r\n\r\n")) != NULL))
+            {
+                char* length = strcasestr(buffer, "Content-Length:");
+                if ((length == NULL) || (length > header)) break;
+                expected = (header + 4 - buffer) + atoi(length + 15);
+            }
+        }
+        if ((expected < 0) || (len < expected)) { close(fd); fd = -1; continue; }
+        if (bench_Measuring) __atomic_fetch_add(&bench_Requests, 1, __ATOMIC_RELAXED);
+    }
+    if (fd != -1) close(fd);
+    return NULL;
+}
+
+
+/* raw samples of /stream, latency from the response written to the event received */
+void* http_Stream_Thread(void* arg)
+{
+    static const char request[] = "GET /stream?raw=1 HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    char buffer[HTTP_BUFFER_SIZE];
+    bool seen[MAX_INVERTERS] = {0};
+    char *event, *end, *address;
+    int64_t received, responseTime;
+    int fd = -1;
+    int len = 0;
+    int rxLen, i;
+    (void)arg;
+    
+    while (bench_Running)
+    {
+        if (fd == -1)
+        {
+            fd = http_Connect();
+            if (fd == -1) { bench_Sleep(100); continue; }
+            if (write(fd, request, sizeof(request) - 1) != sizeof(request) - 1) { close(fd); fd = -1; continue; }
+            len = 0;
+        }
+        
+        rxLen = read(fd, &buffer[len], sizeof(buffer) - 1 - len);
+        if (rxLen <= 0) { close(fd); fd = -1; continue; }
+        received = bench_Now();
+        len += rxLen;
+        buffer[len] = '\0';
+        
+        event = buffer;
+        while ((end = strstr(event, "\n\n")) != NULL)
+        {
+            *end = '\0';
+            address = strstr(event, "\"address\":");
+            if ((address != NULL) && (strstr(event, "\"valid\":1") != NULL))
+            {
+                i = atoi(address + 10) - FIRST_ADDRESS;
+                if ((i >= 0) && (i < arg_Inverters))
+                {
+                    if (!seen[i]) { seen[i] = true; __atomic_fetch_add(&bench_Ready, 1, __ATOMIC_RELAXED); }
+                    responseTime = __atomic_load_n(&bench_Inverters[i].responseTime, __ATOMIC_ACQUIRE);
+                    if (bench_Measuring)
+                    {
+                        pthread_mutex_lock(&bench_Mutex);
+                        bench_Samples++;
+                        if (bench_LatencyCount < MAX_LATENCY_SAMPLES) bench_Latency[bench_LatencyCount++] = (received - responseTime) / 1e6;
+                        pthread_mutex_unlock(&bench_Mutex);
+                    }
+                }
+            }
+            event = end + 2;
+        }
+        len -= event - buffer;
+        memmove(buffer, event, len);
+        if (len == sizeof(buffer) - 1) len = 0;
+    }
+    if (fd != -1) close(fd);
+    return NULL;
+}
+
+
+
+/* --- solaXd under test --- */
+pid_t solaxd_Start(char device[], char* extra[], int extraCount)
+{
+    char* argv[32 + 16];
+    char port[16], interval[16], addresses[64];
+    int argc = 0;
+    int i, len = 0;
+    pid_t pid;
+    
+    snprintf(port, sizeof(port), "%d", arg_TCP_Port);
+    snprintf(interval, sizeof(interval), "%d", arg_QueryInterval);
+    for (i = 0; i < arg_Inverters; i++)
+    {
+        len += snprintf(&addresses[len], sizeof(addresses) - len, "%s%d", i ? "," : "", FIRST_ADDRESS + i);
+    }
+    
+    argv[argc++] = arg_Binary;
+    argv[argc++] = "-d";  argv[argc++] = device;
+    argv[argc++] = "-p";  argv[argc++] = port;
+    argv[argc++] = "-i";  argv[argc++] = interval;
+    argv[argc++] = "-a";  argv[argc++] = addresses;
+    argv[argc++] = "-L";  argv[argc++] = "0";
+    for (i = 0; (i < extraCount) && (argc < 32 + 15); i++) argv[argc++] = extra[i];
+    argv[argc] = NULL;
+    
+    pid = fork();
+    if (pid == 0)
+    {
+        close(fd_pty_master);
+        execv(arg_Binary, argv);
+        fprintf(stderr, "%s: Error starting '%s': %s\n", BENCH_STRING, arg_Binary, strerror(errno));
+        _exit(127);
+    }
+    return pid;
+}
+
+
+/* user + system time of the process (in seconds) */
+double solaxd_CpuTime(pid_t pid)
+{
+    char path[64], buffer[1024];
+    unsigned long utime = 0, stime = 0;
+    char* fields;
+    FILE* fp;
+    
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    fp = fopen(path, "r");
+    if (fp == NULL) return 0;
+    if (fgets(buffer, sizeof(buffer), fp) == NULL) buffer[0] = '\0';
+    fclose(fp);
+    
+    // fields after the command name in parentheses, utime and stime are the 14th and 15th field
+    fields = strrchr(buffer, ')');
+    if (fields == NULL) return 0;
+    sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime);
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+
+int compare_Double(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+
+double bench_Percentile(double percent)
+{
+    int i;
+    
+    if (bench_LatencyCount == 0) return 0;
+    i = (int)(percent / 100 * (bench_LatencyCount - 1) + 0.5);
+    return bench_Latency[i];
+}
+
+
+
+/*** MAIN ******************************************************************************************/
+
+int main(int argc, char* argv[])
+{
+    pthread_t threadSim, threadStream, threadClients[64];
+    char slaveName[64];
+    double cpuStart, cpuEnd, elapsed;
+    int64_t timeStart, timeEnd;
+    int opt, i, status;
+    pid_t pid;
+    
+    if ((argc == 2) && (strcmp(argv[1], "--help") == 0))
+    {
+        printf("Usage: %s [OPTION] ... [-- SOLAXD_OPTION ...]\n", BENCH_STRING);
+        printf("End-to-end benchmark of solaXd with simulated SolaX-X1_Mini inverters on a pseudo-terminal.\n");
+        printf("    Options:      The default value for each option is shown in square brackets.\n");
+        printf("      -b <FILE>   solaXd binary  [%s]\n", DEFAULT_SOLAXD_BINARY);
+        printf("      -p <PORT>   Port of the HTTP-Server of solaXd  [%d]\n", DEFAULT_TCP_PORT);
+        printf("      -n <COUNT>  Simulated inverters, bus addresses from %d  [%d]\n", FIRST_ADDRESS, DEFAULT_INVERTERS);
+        printf("      -T <SECONDS> Duration of the measurement  [%d]\n", DEFAULT_DURATION);
+        printf("      -c <COUNT>  HTTP load generator connections  [%d]\n", DEFAULT_CLIENTS);
+        printf("      -l <MS>     Response delay of the inverters  [%d]\n", DEFAULT_LATENCY);
+        printf("      -e <PERCENT> Responses with CRC error  [%d]\n", DEFAULT_CRC_ERRORS);
+        printf("      -s <PERCENT> Responses written as partial frames  [%d]\n", DEFAULT_PARTIAL_FRAMES);
+        printf("      -i <MS>     Query interval of solaXd  [%d]\n", DEFAULT_QUERY_INTERVAL);
+        printf("      --help      Display this help and exit\n");
+        return 0;
+    }
+    
+    while ((opt = getopt(argc, argv, ":b:p:n:T:c:l:e:s:i:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'b': arg_Binary = optarg; break;
+            case 'p': arg_TCP_Port = atoi(optarg); break;
+            case 'n': arg_Inverters = atoi(optarg); break;
+            case 'T': arg_Duration = atoi(optarg); break;
+            case 'c': arg_Clients = atoi(optarg); break;
+            case 'l': arg_Latency = atoi(optarg); break;
+            case 'e': arg_CrcErrors = atoi(optarg); break;
+            case 's': arg_PartialFrames = atoi(optarg); break;
+            case 'i': arg_QueryInterval = atoi(optarg); break;
+            case ':': fprintf(stderr, "Option -%c requires an argument.\n", optopt); return -1;
+            default:  fprintf(stderr, "Unknown option '-%c'.\n", optopt); return -1;
+        }
+    }
+    if ((arg_Inverters < 1) || (arg_Inverters > MAX_INVERTERS)) { fprintf(stderr, "Inverters must be in range 1..%d.\n", MAX_INVERTERS); return -1; }
+    if ((arg_Clients < 0) || (arg_Clients > 64)) { fprintf(stderr, "Connections must be in range 0..64.\n"); return -1; }
+    
+    signal(SIGPIPE, SIG_IGN);
+    for (i = 0; i < arg_Inverters; i++)
+    {
+        snprintf((char*)bench_Inverters[i].serialNumber, 14, "SIM%010d", i);
+        bench_Inverters[i].serialNumber[13] = '0' + i;
+    }
+    
+    if (sim_Open(slaveName, sizeof(slaveName)) == -1) { fprintf(stderr, "%s: Error opening pseudo-terminal: %s\n", BENCH_STRING, strerror(errno)); return -1; }
+    pthread_create(&threadSim, NULL, sim_Thread, NULL);
+    
+    pid = solaxd_Start(slaveName, &argv[optind], argc - optind);
+    if (pid == -1) { fprintf(stderr, "%s: Error starting solaXd: %s\n", BENCH_STRING, strerror(errno)); return -1; }
+    
+    // warm up until all inverters are registered and deliver samples
+    pthread_create(&threadStream, NULL, http_Stream_Thread, NULL);
+    for (i = 0; (i < WARMUP_TIMEOUT * 10) && (__atomic_load_n(&bench_Ready, __ATOMIC_RELAXED) < arg_Inverters); i++)
+    {
+        if (waitpid(pid, &status, WNOHANG) == pid) { fprintf(stderr, "%s: solaXd exited during warm up\n", BENCH_STRING); return -1; }
+        bench_Sleep(100);
+    }
+    if (bench_Ready < arg_Inverters) fprintf(stderr, "%s: Only %d of %d inverters online after %d s\n", BENCH_STRING, bench_Ready, arg_Inverters, WARMUP_TIMEOUT);
+    
+    for (i = 0; i < arg_Clients; i++) pthread_create(&threadClients[i], NULL, http_Client_Thread, NULL);
+    bench_Sleep(200);
+    
+    cpuStart = solaxd_CpuTime(pid);
+    timeStart = bench_Now();
+    bench_Measuring = true;
+    bench_Sleep(arg_Duration * 1000);
+    bench_Measuring = false;
+    timeEnd = bench_Now();
+    cpuEnd = solaxd_CpuTime(pid);
+    
+    bench_Running = false;
+    kill(pid, SIGTERM);
+    waitpid(pid, &status, 0);
+    for (i = 0; i < arg_Clients; i++) pthread_join(threadClients[i], NULL);
+    pthread_join(threadStream, NULL);
+    pthread_join(threadSim, NULL);
+    
+    elapsed = (timeEnd - timeStart) / 1e9;
+    qsort(bench_Latency, bench_LatencyCount, sizeof(double), compare_Double);
+    
+    printf("%s: %d inverter(s), %d s, %d connection(s), delay %d ms, crc errors %d %%, partial frames %d %%, interval %d ms\n",
+           BENCH_STRING, arg_Inverters, arg_Duration, arg_Clients, arg_Latency, arg_CrcErrors, arg_PartialFrames, arg_QueryInterval);
+    printf("  bus:     %.1f queries/s, %.1f responses/s, %llu crc errors, %llu partial frames\n",
+           bench_Bus.queries / elapsed, bench_Bus.responses / elapsed, (unsigned long long)bench_Bus.crcErrors, (unsigned long long)bench_Bus.partialFrames);
+    printf("  samples: %llu valid, %.1f/s, response to /stream p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+           (unsigned long long)bench_Samples, bench_Samples / elapsed, bench_Percentile(50), bench_Percentile(90), bench_Percentile(99), bench_Percentile(100));
+    printf("  http:    %llu requests, %.0f req/s\n", (unsigned long long)bench_Requests, bench_Requests / elapsed);
+    printf("  cpu:     %.2f s (%.1f %%), %.3f ms per sample\n",
+           cpuEnd - cpuStart, 100 * (cpuEnd - cpuStart) / elapsed, bench_Samples ? 1000 * (cpuEnd - cpuStart) / bench_Samples : 0);
+    
+    return (WIFEXITED(status) && (WEXITSTATUS(status) == 0)) ? 0 : 1;
+}